@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
 #include <err.h>
-#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -7,272 +10,854 @@
 #include <string.h>
 #include <unistd.h>
 
-#define LD_SO_CACHE "/etc/ld.so.cache"
-
-#define CACHEMAGIC_OLD "ld.so-1.7.0"
-#define CACHEMAGIC_NEW "glibc-ld.so.cache1.1"
-
-#define ALIGN_TYPE_OFFSET(addr, type) \
-    ((__alignof__(type) - 1) & (~(__alignof__(type) - 1)))
-
-#define FLAGS_ELF    0x00000001
-#define FLAGS_I386   0x00000800
-#define FLAGS_X86_64 0x00000300
-
-/* Older versions of libc had a very simple format for ld.so.cache. The file
- * simply listed the number of libary entries, followed by the entries
- * themselves, followed by a string table holding strings pointed to by the
- * library entries. This format is summarized below:
-
-        CACHEMAGIC_OLD
-        nlibs
-        libs[0]
-        ...
-        libs[nlibs-1]
-        string[0] -- Address of offset 0 in strtab
-        ...
-        string[n]
-
- * For glibc 2.2 and beyond, a new format was created so that each
- * library entry could hold more meta-data about the libraries they
- * reference. To preserve backwards compatibility, the new format was
- * embedded in the old format inside its string table (simply moving
- * all existing strings further down in the string table). This makes
- * sense for backwards comaptibility because code that could parse the
- * old format  still works (the offsets for strings pointed to by
- * the library entries are just larger now).
- *
- * However, it adds complications when parsing for the new format
- * because the new format' header needs to be aligned on an 8 byte
- * boundary (potentially pushing the start address of the string table
- * down a few bytes). A summary of the new format embedded in the old
- * format with annotations on the start address of the string table
- * can be seen below:
-
-        CACHEMAGIC_OLD
-        nlibs
-        libs[0]
-        ...
-        libs[nlibs-1]
-        pad (align for new format) -- Address of offset 0 in the old strtab
-        CACHEMAGIC_NEW             -- Address of offset 0 in the new strtab
-        nlibs
-        len_strings
-        unused -- 20 bytes reserved for future extensions
-        libs[0]
-        ...
-        libs[newnlibs-1]
-        string[0]
-        ...
-        string[n]
-*/
-
-struct header_old
+#include "ldcache.h"
+#include "outbuf.h"
+
+bool parseMapHint(const char *str, int *flags)
 {
-  char magic[sizeof(CACHEMAGIC_OLD) - 1];
-  uint32_t nlibs;
+    static const struct {
+        const char *name;
+        int flags;
+    } hints[] = {
+        { "none",       0 },
+        { "populate",   LDCACHE_MAP_POPULATE },
+        { "willneed",   LDCACHE_MAP_WILLNEED },
+        { "sequential", LDCACHE_MAP_SEQUENTIAL },
+        { "random",     LDCACHE_MAP_RANDOM },
+    };
+
+    for (size_t i = 0; i < sizeof(hints)/sizeof(hints[0]); i++) {
+        if (strcmp(str, hints[i].name) == 0) {
+            *flags = hints[i].flags;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* Output formats for entries. */
+enum format {
+    FORMAT_TEXT,     /* One 'libs_new[i].field: value' line per field. */
+    FORMAT_LDCONFIG, /* The same layout as 'ldconfig -p'. */
+    FORMAT_TSV,      /* One tab separated line per entry. */
+    FORMAT_JSON,     /* One JSON object per line (NDJSON) per entry. */
 };
 
-struct libentry_old
+
+bool parseFormat(const char *str, enum format *format)
 {
-  int32_t flags;  /* 0x01 indicated ELF library. */
-  uint32_t key;   /* String table index. */
-  uint32_t value; /* String table index. */
-};
+    static const struct {
+        const char *name;
+        enum format format;
+    } formats[] = {
+        { "text",     FORMAT_TEXT },
+        { "ldconfig", FORMAT_LDCONFIG },
+        { "tsv",      FORMAT_TSV },
+        { "json",     FORMAT_JSON },
+    };
+
+    for (size_t i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+        if (strcmp(str, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return true;
+        }
+    }
+    return false;
+}
+
 
-struct header_new
+struct options
 {
-  char magic[sizeof(CACHEMAGIC_NEW) - 1];
-  uint32_t nlibs;     /* Number of entries.  */
-  uint32_t stringslen; /* Size of string table. */
-  uint32_t unused[5]; /* Leave space for future extensions
-                         and align to 8 byte boundary. */
+  enum format format;
+  const char *path; /* Cache to use outside of scan mode. */
+  const char *index; /* Index file for lookups, or NULL. */
+  int flags;        /* Flags for ldcache_open(). */
+  bool lazy;        /* Skip up front validation of every entry. */
+  bool filter;      /* Only show entries for 'arch'. */
+  enum ldcache_arch arch;
 };
 
-struct libentry_new
+
+/* Equivalent of printf("%#x"), which prints no prefix for 0. */
+void printAltHex(struct outbuf *out, uint64_t value)
+{
+    if (value != 0) {
+        outbuf_write(out, "0x", 2);
+    }
+    outbuf_hex(out, value, 0);
+}
+
+
+void printField(struct outbuf *out, uint32_t index, const char *field)
+{
+    outbuf_write(out, "libs_new[", 9);
+    outbuf_u64(out, index);
+    outbuf_write(out, "].", 2);
+    outbuf_str(out, field);
+    outbuf_write(out, ": ", 2);
+}
+
+
+/* Print "key (flags[, hwcap: 0x...]" as 'ldconfig -p' starts each
+ * line, leaving the parenthesis open for more attributes. */
+void printIdentity(struct outbuf *out, const struct ldcache_entry *entry,
+                   const char *flags)
+{
+    outbuf_str(out, entry->key);
+    outbuf_write(out, " (", 2);
+    outbuf_str(out, flags);
+    if (entry->hwcap != 0) {
+        outbuf_write(out, ", hwcap: 0x", 11);
+        outbuf_hex(out, entry->hwcap, 16);
+    }
+}
+
+
+/* Print 'entry' in the selected format. 'path' names the cache the
+ * entry came from, and is only used when scanning many caches. */
+void printEntry(struct outbuf *out, const struct options *opts,
+                const char *path, const struct ldcache_entry *entry)
+{
+    char flags[64];
+    ldcache_flags_str(entry->flags, flags, sizeof(flags));
+
+    switch (opts->format) {
+        case FORMAT_TEXT:
+            printField(out, entry->index, "flags");
+            printAltHex(out, (uint32_t)entry->flags);
+            outbuf_write(out, " (", 2);
+            outbuf_str(out, flags);
+            outbuf_write(out, ")\n", 2);
+            printField(out, entry->index, "key");
+            outbuf_str(out, entry->key);
+            outbuf_char(out, '\n');
+            printField(out, entry->index, "value");
+            outbuf_str(out, entry->value);
+            outbuf_char(out, '\n');
+            printField(out, entry->index, "osversion");
+            outbuf_u64(out, entry->osversion);
+            outbuf_char(out, '\n');
+            printField(out, entry->index, "hwcap");
+            outbuf_u64(out, entry->hwcap);
+            outbuf_char(out, '\n');
+            break;
+
+        case FORMAT_LDCONFIG: {
+            static const char *const abi_tag_os[] = {
+                "Linux", "Hurd", "Solaris", "FreeBSD", "kNetBSD",
+                "Syllable", "Unknown OS",
+            };
+
+            outbuf_char(out, '\t');
+            printIdentity(out, entry, flags);
+            if (entry->osversion != 0) {
+                uint32_t os = entry->osversion >> 24;
+                if (os > 6) {
+                    os = 6;
+                }
+                outbuf_write(out, ", OS ABI: ", 10);
+                outbuf_str(out, abi_tag_os[os]);
+                outbuf_char(out, ' ');
+                outbuf_u64(out, (entry->osversion >> 16) & 0xff);
+                outbuf_char(out, '.');
+                outbuf_u64(out, (entry->osversion >> 8) & 0xff);
+                outbuf_char(out, '.');
+                outbuf_u64(out, entry->osversion & 0xff);
+            }
+            outbuf_write(out, ") => ", 5);
+            outbuf_str(out, entry->value);
+            outbuf_char(out, '\n');
+            break;
+        }
+
+        case FORMAT_TSV:
+            if (path != NULL) {
+                outbuf_str(out, path);
+                outbuf_char(out, '\t');
+            }
+            outbuf_u64(out, entry->index);
+            outbuf_write(out, "\t0x", 3);
+            outbuf_hex(out, (uint32_t)entry->flags, 4);
+            outbuf_char(out, '\t');
+            outbuf_str(out, flags);
+            outbuf_char(out, '\t');
+            outbuf_str(out, entry->key);
+            outbuf_char(out, '\t');
+            outbuf_str(out, entry->value);
+            outbuf_char(out, '\t');
+            outbuf_u64(out, entry->osversion);
+            outbuf_write(out, "\t0x", 3);
+            outbuf_hex(out, entry->hwcap, 16);
+            outbuf_char(out, '\n');
+            break;
+
+        case FORMAT_JSON: {
+            const char *arch =
+                ldcache_arch_name(ldcache_flags_arch(entry->flags));
+
+            outbuf_char(out, '{');
+            if (path != NULL) {
+                outbuf_json_key(out, "cache", true);
+                outbuf_json_str(out, path);
+            }
+            outbuf_json_key(out, "index", path == NULL);
+            outbuf_u64(out, entry->index);
+            outbuf_json_key(out, "flags", false);
+            outbuf_i64(out, entry->flags);
+            outbuf_json_key(out, "type", false);
+            outbuf_json_str(out, flags);
+            outbuf_json_key(out, "arch", false);
+            outbuf_json_str(out, arch ? arch : "unknown");
+            outbuf_json_key(out, "key", false);
+            outbuf_json_str(out, entry->key);
+            outbuf_json_key(out, "value", false);
+            outbuf_json_str(out, entry->value);
+            outbuf_json_key(out, "osversion", false);
+            outbuf_u64(out, entry->osversion);
+            outbuf_json_key(out, "hwcap", false);
+            outbuf_u64(out, entry->hwcap);
+            outbuf_write(out, "}\n", 2);
+            break;
+        }
+    }
+}
+
+
+/* Open and validate the cache at 'path'. On failure, an error message
+ * is written to 'msg' and NULL is returned, so that callers scanning
+ * many caches can carry on with the rest. */
+struct ldcache *loadCache(const char *path, const struct options *opts,
+                          char *msg, size_t len)
+{
+    /* Always open lazily, and then validate every entry explicitly
+     * (unless -l was given) so that a bad entry can be reported by
+     * index. */
+    struct ldcache *cache;
+    int ret = ldcache_open(&cache, path, opts->flags | LDCACHE_LAZY);
+    if (ret == LDCACHE_ERROR_OPEN || ret == LDCACHE_ERROR_MMAP) {
+        snprintf(msg, len, "error loading '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+    if (ret != LDCACHE_SUCCESS) {
+        snprintf(msg, len, "error parsing '%s': %s",
+                 path, ldcache_strerror(ret));
+        return NULL;
+    }
+
+    if (!opts->lazy) {
+        size_t bad;
+        ret = ldcache_validate(cache, &bad);
+        if (ret == LDCACHE_ERROR_FORMAT) {
+            snprintf(msg, len, "error parsing '%s': libs_new[%zu] has an "
+                     "out of bounds string offset", path, bad);
+            ldcache_close(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+
+/* Dump the headers and every entry (or only those of the selected
+ * architecture) of the cache at 'path' to 'out'. 'scan' is set when
+ * the dump is one of many. */
+int dumpCache(struct outbuf *out, struct ldcache *cache,
+              const struct options *opts, const char *path, bool scan)
 {
-  int16_t flags;        /* Flags bits determine arch and library type. */
-  uint32_t key;         /* String table index. */
-  uint32_t value;       /* String table index. */
-  uint32_t osversion;   /* Required OS version. */
-  uint64_t hwcap;       /* Hwcap entry. */
+    struct ldcache_info info;
+    ldcache_info(cache, &info);
+
+    const uint32_t *indices = NULL;
+    size_t count = ldcache_count(cache);
+    if (opts->filter) {
+        int ret = ldcache_arch_view(cache, opts->arch, &indices, &count);
+        if (ret != LDCACHE_SUCCESS) {
+            return ret;
+        }
+    }
+
+    switch (opts->format) {
+        case FORMAT_TEXT:
+            if (scan) {
+                outbuf_str(out, "cache: ");
+                outbuf_str(out, path);
+                outbuf_char(out, '\n');
+            }
+            if (info.format == LDCACHE_FORMAT_COMPAT) {
+                outbuf_str(out, "header_old->magic: ");
+                outbuf_str(out, info.old_magic);
+                outbuf_str(out, "\nheader_old->nlibs: ");
+                outbuf_u64(out, info.old_nlibs);
+                outbuf_char(out, '\n');
+            }
+            outbuf_str(out, "header_new->magic: ");
+            outbuf_str(out, info.new_magic);
+            outbuf_str(out, "\nheader_new->nlibs: ");
+            outbuf_u64(out, info.new_nlibs);
+            outbuf_char(out, '\n');
+            break;
+        case FORMAT_LDCONFIG:
+            outbuf_u64(out, count);
+            outbuf_str(out, " libs found in cache `");
+            outbuf_str(out, path);
+            outbuf_str(out, "'\n");
+            break;
+        case FORMAT_TSV:
+        case FORMAT_JSON:
+            break;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct ldcache_entry entry;
+        int ret = ldcache_entry(cache, indices ? indices[i] : i, &entry);
+        if (ret != LDCACHE_SUCCESS) {
+            return ret;
+        }
+        printEntry(out, opts, scan ? path : NULL, &entry);
+    }
+
+    return LDCACHE_SUCCESS;
+}
+
+
+/* State shared by the scan workers. Each worker claims the next
+ * unscanned path, and parses and formats it into a private buffer. The
+ * only thing they share is the output sink, which the finished buffer
+ * is appended to as one block under 'lock'. */
+struct scan
+{
+  const struct options *opts;
+  struct outbuf *out;
+  char **paths;
+  int npaths;
+  bool rootfs;       /* Paths are root filesystems, not caches. */
+  int next;          /* Next path to claim, updated atomically. */
+  int failed;        /* Number of caches that failed, ditto. */
+  pthread_mutex_t lock;
 };
 
 
-bool validatePtr(char *base, uint32_t limit, char *ptr, uint32_t offset)
+void scanOne(struct scan *scan, const char *arg)
 {
-    if (ptr + offset < base)
-        return false;
+    char path[PATH_MAX];
+    char msg[PATH_MAX + 128];
+
+    if (scan->rootfs) {
+        if ((size_t)snprintf(path, sizeof(path), "%s%s", arg,
+                             LDCACHE_DEFAULT_PATH) >= sizeof(path)) {
+            snprintf(msg, sizeof(msg), "'%s': path too long", arg);
+            goto fail;
+        }
+    } else {
+        snprintf(path, sizeof(path), "%s", arg);
+    }
+
+    struct ldcache *cache = loadCache(path, scan->opts, msg, sizeof(msg));
+    if (cache == NULL) {
+        goto fail;
+    }
+
+    struct outbuf out;
+    if (outbuf_init(&out, -1, 0) == -1) {
+        snprintf(msg, sizeof(msg), "'%s': %s", path, strerror(errno));
+        ldcache_close(cache);
+        goto fail;
+    }
+
+    int ret = dumpCache(&out, cache, scan->opts, path, true);
+    ldcache_close(cache);
+
+    if (ret == LDCACHE_SUCCESS && out.error != 0) {
+        ret = LDCACHE_ERROR_NOMEM;
+    }
+    if (ret != LDCACHE_SUCCESS) {
+        snprintf(msg, sizeof(msg), "error parsing '%s': %s",
+                 path, ldcache_strerror(ret));
+        outbuf_free(&out);
+        goto fail;
+    }
 
-    if (ptr + offset >= base + limit)
-        return false;
+    pthread_mutex_lock(&scan->lock);
+    outbuf_write(scan->out, out.buf, out.len);
+    pthread_mutex_unlock(&scan->lock);
+    outbuf_free(&out);
+    return;
+
+fail:
+    __atomic_add_fetch(&scan->failed, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&scan->lock);
+    warnx("%s", msg);
+    pthread_mutex_unlock(&scan->lock);
+}
 
-    return true;
+
+void *scanWorker(void *arg)
+{
+    struct scan *scan = arg;
+
+    for (;;) {
+        int i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+        if (i >= scan->npaths) {
+            break;
+        }
+        scanOne(scan, scan->paths[i]);
+    }
+    return NULL;
 }
 
 
-int main(int argc, char **argv)
+/* Parse and dump each of 'paths' concurrently on 'jobs' threads.
+ * Returns the number of caches that could not be dumped. */
+int scanCaches(struct outbuf *out, const struct options *opts,
+               char **paths, int npaths, bool rootfs, long jobs)
 {
-    FILE *file = fopen(LD_SO_CACHE, "rb");
-    if (file == NULL) {
-        err(EXIT_FAILURE, "fopen '%s' failed", LD_SO_CACHE);
+    struct scan scan = {
+        .opts = opts,
+        .out = out,
+        .paths = paths,
+        .npaths = npaths,
+        .rootfs = rootfs,
+    };
+    pthread_mutex_init(&scan.lock, NULL);
+
+    if (jobs > npaths) {
+        jobs = npaths;
     }
 
-    if (fseek(file, 0, SEEK_END) == -1) {
-        fclose(file);
-        err(EXIT_FAILURE, "fseek() failed");
+    pthread_t threads[jobs];
+    long started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, scanWorker, &scan) != 0) {
+            break;
+        }
+    }
+
+    /* Without any worker threads, do the work on this one. */
+    if (started == 0) {
+        scanWorker(&scan);
+    }
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&scan.lock);
+    return scan.failed;
+}
+
+
+/* Order entries by identity: soname, flags and hwcap. Entries with the
+ * same identity stay in cache order, so duplicates pair up in order. */
+int compareIdentity(const void *a, const void *b)
+{
+    const struct ldcache_entry *ea = a;
+    const struct ldcache_entry *eb = b;
+
+    int ret = strcmp(ea->key, eb->key);
+    if (ret != 0) {
+        return ret;
+    }
+    if (ea->flags != eb->flags) {
+        return ea->flags < eb->flags ? -1 : 1;
+    }
+    if (ea->hwcap != eb->hwcap) {
+        return ea->hwcap < eb->hwcap ? -1 : 1;
+    }
+    return (ea->index > eb->index) - (ea->index < eb->index);
+}
+
+
+/* Load every entry of the cache at 'path' (or those of the selected
+ * architecture) sorted by identity. Exits with status 2 on errors, as
+ * diff(1) does. */
+struct ldcache_entry *sortedEntries(struct ldcache **cache, const char *path,
+                                    const struct options *opts, size_t *n)
+{
+    char msg[PATH_MAX + 128];
+    *cache = loadCache(path, opts, msg, sizeof(msg));
+    if (*cache == NULL) {
+        errx(2, "%s", msg);
+    }
+
+    const uint32_t *indices = NULL;
+    size_t count = ldcache_count(*cache);
+    if (opts->filter) {
+        int ret = ldcache_arch_view(*cache, opts->arch, &indices, &count);
+        if (ret != LDCACHE_SUCCESS) {
+            errx(2, "error parsing '%s': %s", path, ldcache_strerror(ret));
+        }
+    }
+
+    struct ldcache_entry *entries = malloc((count ? count : 1) *
+                                           sizeof(*entries));
+    if (entries == NULL) {
+        err(2, "malloc() failed");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int ret = ldcache_entry(*cache, indices ? indices[i] : i,
+                                &entries[i]);
+        if (ret != LDCACHE_SUCCESS) {
+            errx(2, "error parsing '%s': %s", path, ldcache_strerror(ret));
+        }
+    }
+
+    qsort(entries, count, sizeof(*entries), compareIdentity);
+    *n = count;
+    return entries;
+}
+
+
+/* Print one difference: an entry only in the old cache ('new' is
+ * NULL), only in the new one ('old' is NULL), or in both with a
+ * different path or OS version. */
+void printChange(struct outbuf *out, const struct options *opts,
+                 const struct ldcache_entry *old,
+                 const struct ldcache_entry *new)
+{
+    static const char *const changes[] = { "changed", "removed", "added" };
+    const struct ldcache_entry *entry = new ? new : old;
+    int change = old == NULL ? 2 : new == NULL ? 1 : 0;
+
+    char flags[64];
+    ldcache_flags_str(entry->flags, flags, sizeof(flags));
+
+    switch (opts->format) {
+        case FORMAT_TEXT:
+        case FORMAT_LDCONFIG:
+            outbuf_char(out, "~-+"[change]);
+            outbuf_char(out, ' ');
+            printIdentity(out, entry, flags);
+            outbuf_write(out, ") => ", 5);
+            if (change == 0 && strcmp(old->value, new->value) != 0) {
+                outbuf_str(out, old->value);
+                outbuf_write(out, " -> ", 4);
+            }
+            outbuf_str(out, entry->value);
+            if (change == 0 && old->osversion != new->osversion) {
+                outbuf_str(out, ", osversion ");
+                printAltHex(out, old->osversion);
+                outbuf_write(out, " -> ", 4);
+                printAltHex(out, new->osversion);
+            }
+            outbuf_char(out, '\n');
+            break;
+
+        case FORMAT_TSV:
+            outbuf_str(out, changes[change]);
+            outbuf_char(out, '\t');
+            outbuf_str(out, entry->key);
+            outbuf_write(out, "\t0x", 3);
+            outbuf_hex(out, (uint32_t)entry->flags, 4);
+            outbuf_char(out, '\t');
+            outbuf_str(out, flags);
+            outbuf_write(out, "\t0x", 3);
+            outbuf_hex(out, entry->hwcap, 16);
+            outbuf_char(out, '\t');
+            if (old != NULL) {
+                outbuf_str(out, old->value);
+            }
+            outbuf_char(out, '\t');
+            if (new != NULL) {
+                outbuf_str(out, new->value);
+            }
+            outbuf_char(out, '\t');
+            if (old != NULL) {
+                outbuf_u64(out, old->osversion);
+            }
+            outbuf_char(out, '\t');
+            if (new != NULL) {
+                outbuf_u64(out, new->osversion);
+            }
+            outbuf_char(out, '\n');
+            break;
+
+        case FORMAT_JSON:
+            outbuf_char(out, '{');
+            outbuf_json_key(out, "change", true);
+            outbuf_json_str(out, changes[change]);
+            outbuf_json_key(out, "key", false);
+            outbuf_json_str(out, entry->key);
+            outbuf_json_key(out, "flags", false);
+            outbuf_i64(out, entry->flags);
+            outbuf_json_key(out, "type", false);
+            outbuf_json_str(out, flags);
+            outbuf_json_key(out, "hwcap", false);
+            outbuf_u64(out, entry->hwcap);
+            for (int i = 0; i < 2; i++) {
+                const struct ldcache_entry *e = i == 0 ? old : new;
+                if (e == NULL) {
+                    continue;
+                }
+                outbuf_json_key(out, i == 0 ? "old" : "new", false);
+                outbuf_char(out, '{');
+                outbuf_json_key(out, "index", true);
+                outbuf_u64(out, e->index);
+                outbuf_json_key(out, "value", false);
+                outbuf_json_str(out, e->value);
+                outbuf_json_key(out, "osversion", false);
+                outbuf_u64(out, e->osversion);
+                outbuf_char(out, '}');
+            }
+            outbuf_write(out, "}\n", 2);
+            break;
+    }
+}
+
+
+/* Compare the caches at 'oldpath' and 'newpath'. Entries are matched
+ * on their identity (soname, flags and hwcap), so both are sorted by it
+ * and walked in a single merge pass. Returns the number of
+ * differences. */
+size_t diffCaches(struct outbuf *out, const struct options *opts,
+                  const char *oldpath, const char *newpath)
+{
+    struct ldcache *oldcache, *newcache;
+    size_t nold, nnew;
+    struct ldcache_entry *old = sortedEntries(&oldcache, oldpath, opts,
+                                              &nold);
+    struct ldcache_entry *new = sortedEntries(&newcache, newpath, opts,
+                                              &nnew);
+
+    size_t i = 0, j = 0, ndiffs = 0;
+    while (i < nold || j < nnew) {
+        int cmp;
+        if (i == nold) {
+            cmp = 1;
+        } else if (j == nnew) {
+            cmp = -1;
+        } else {
+            /* Compare identities only, not positions. */
+            struct ldcache_entry a = old[i], b = new[j];
+            a.index = b.index = 0;
+            cmp = compareIdentity(&a, &b);
+        }
+
+        if (cmp < 0) {
+            printChange(out, opts, &old[i++], NULL);
+            ndiffs++;
+        } else if (cmp > 0) {
+            printChange(out, opts, NULL, &new[j++]);
+            ndiffs++;
+        } else {
+            if (strcmp(old[i].value, new[j].value) != 0 ||
+                old[i].osversion != new[j].osversion) {
+                printChange(out, opts, &old[i], &new[j]);
+                ndiffs++;
+            }
+            i++;
+            j++;
+        }
     }
 
-    size_t filelen = ftell(file);
-    if (filelen == -1) {
-        fclose(file);
-        err(EXIT_FAILURE, "ftell() failed");
+    free(old);
+    free(new);
+    ldcache_close(oldcache);
+    ldcache_close(newcache);
+    return ndiffs;
+}
+
+
+void flushOutput(struct outbuf *out)
+{
+    if (outbuf_flush(out) == -1) {
+        err(EXIT_FAILURE, "write() failed");
     }
+    outbuf_free(out);
+}
+
 
-    if (fseek(file, 0, SEEK_SET) == -1) {
-        fclose(file);
-        err(EXIT_FAILURE, "fseek() failed");
+void usage(const char *prog)
+{
+    errx(EXIT_FAILURE, "usage: %s [-a arch] [-f cache] [-g] [-i] [-l] "
+        "[-m none|populate|willneed|sequential|random] "
+        "[-o text|ldconfig|tsv|json] [-x index] [soname|pattern...]\n"
+        "       %s -c|-r [-j jobs] [-a arch] [-l] [-m hint] [-o format] "
+        "path...\n"
+        "       %s -d [-a arch] [-l] [-o format] old-cache new-cache",
+        prog, prog, prog);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct options opts = { .path = LDCACHE_DEFAULT_PATH };
+    int hint = 0;
+    bool scan = false;
+    bool rootfs = false;
+    bool diff = false;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int (*query)(struct ldcache *, const char *, struct ldcache_entry *,
+                 size_t, size_t *) = ldcache_lookup;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:cdf:gij:lm:o:rx:")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (ldcache_arch_parse(optarg, &opts.arch) != LDCACHE_SUCCESS) {
+                    errx(EXIT_FAILURE, "unknown architecture '%s'", optarg);
+                }
+                opts.filter = true;
+                break;
+            case 'c':
+                scan = true;
+                rootfs = false;
+                break;
+            case 'd':
+                diff = true;
+                break;
+            case 'f':
+                opts.path = optarg;
+                break;
+            case 'g':
+                query = ldcache_search;
+                break;
+            case 'i':
+                opts.flags |= LDCACHE_INDEX;
+                break;
+            case 'j':
+                jobs = strtol(optarg, NULL, 10);
+                if (jobs < 1 || jobs > 1024) {
+                    errx(EXIT_FAILURE, "invalid number of jobs '%s'", optarg);
+                }
+                break;
+            case 'l':
+                opts.lazy = true;
+                break;
+            case 'm':
+                if (!parseMapHint(optarg, &hint)) {
+                    errx(EXIT_FAILURE, "unknown mapping hint '%s'", optarg);
+                }
+                break;
+            case 'o':
+                if (!parseFormat(optarg, &opts.format)) {
+                    errx(EXIT_FAILURE, "unknown output format '%s'", optarg);
+                }
+                break;
+            case 'r':
+                scan = true;
+                rootfs = true;
+                break;
+            case 'x':
+                opts.index = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
     }
+    opts.flags |= hint;
 
-    char *buffer = malloc(filelen);
-    if (buffer == NULL) {
-        fclose(file);
+    struct outbuf out;
+    if (outbuf_init(&out, STDOUT_FILENO, 0) == -1) {
         err(EXIT_FAILURE, "malloc() failed");
     }
 
-    size_t ret = fread(buffer, 1, filelen, file);
-    if (ret != filelen) {
-        free(buffer);
-        fclose(file);
-        err(EXIT_FAILURE, "fread() failed");
-    }
-
-    /* Construct pointers to all of the important regions in the old
-     * format: the header, the libentry array, the strtab. */
-    char *bufptr = buffer;
-    uint32_t offset = 0;
-
-    struct header_old *header_old = (struct header_old*)bufptr;
-    offset = sizeof(struct header_old);
-    if (!validatePtr(buffer, filelen, bufptr, offset)) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-    bufptr += offset;
-    
-    struct libentry_old *libs_old = (struct libentry_old*)bufptr;
-    offset = header_old->nlibs * sizeof(struct libentry_old);
-    if (!validatePtr(buffer, filelen, bufptr, offset)) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-    bufptr += offset;
-
-    char *strtab = (char *)bufptr;
-
-    /* Assuming we are working with the new format (it is the only
-     * fomat we support), the header and all of its library entries
-     * are embedded in the old format's string table. The header
-     * itself is aligned on an 8 byte boundary, so we need to align
-     * our bufptr here to get it to point to the new header. */
-    offset = ALIGN_TYPE_OFFSET((uintptr_t)bufptr, struct header_new);
-    if (!validatePtr(buffer, filelen, bufptr, offset)) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-    bufptr += offset;
-
-    /* Construct pointers to all of the important regions in the new
-     * format: the header, the libentry array, and the new strtab
-     * (which starts at the same address as the aligned header_new
-     * pointer). */
-    struct header_new *header_new = (struct header_new*)bufptr;
-    offset = sizeof(struct header_new);
-    if (!validatePtr(buffer, filelen, bufptr, offset)) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-    bufptr += offset;
-
-    struct libentry_new *libs_new = (struct libentry_new*)bufptr;
-    offset = header_new->nlibs * sizeof(struct libentry_new);
-    if (!validatePtr(buffer, filelen, bufptr, offset)) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-    bufptr += offset;
-
-    strtab = (char *)header_new;
-
-    /* Adjust bufptr to add on the additional size of the strings
-     * contained in the string table. At this point, bufptr should
-     * point to an address just beyond the end of the file. */
-    bufptr += header_new->stringslen;
-
-    if ((bufptr - buffer) != filelen) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-
-    if (strncmp(header_old->magic,
-                CACHEMAGIC_OLD,
-                sizeof(CACHEMAGIC_OLD) - 1) != 0) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-
-    if (strncmp(header_new->magic,
-                CACHEMAGIC_NEW,
-                sizeof(CACHEMAGIC_NEW) - 1) != 0) {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-
-    /* Make sure the very last character in the buffer is a '\0'. This
-     * way, no matter what strings we index in the string table, we
-     * know they will never run beyond the end of the file buffer when
-     * extracting them. */
-    if (*(bufptr - 1) != '\0') {
-        free(buffer);
-        fclose(file);
-        errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
-    }
-
-    /* Validate all string offsets are within the bounds of the strtab. */
-    for (int i = 0; i < header_new->nlibs; i++) {
-        if (strtab + libs_new[i].key >= bufptr) {
-            free(buffer);
-            fclose(file);
-            errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
+    /* In diff mode, the exit status follows diff(1): 0 if the caches
+     * hold the same entries, 1 if they differ and 2 on errors. */
+    if (diff) {
+        if (argc - optind != 2) {
+            usage(argv[0]);
         }
-        if (strtab + libs_new[i].value >= bufptr) {
-            free(buffer);
-            fclose(file);
-            errx(EXIT_FAILURE, "error parsing '%s'", LD_SO_CACHE);
+        size_t ndiffs = diffCaches(&out, &opts, argv[optind],
+                                   argv[optind + 1]);
+        if (outbuf_flush(&out) == -1) {
+            err(2, "write() failed");
         }
+        outbuf_free(&out);
+        return ndiffs ? 1 : 0;
     }
 
-    printf("header_old->magic: %.*s\n", sizeof(CACHEMAGIC_OLD) - 1, header_old->magic);
-    printf("header_old->nlibs: %d\n", header_old->nlibs);
-    printf("header_new->magic: %.*s\n", sizeof(CACHEMAGIC_NEW) - 1, header_new->magic);
-    printf("header_new->nlibs: %d\n", header_new->nlibs);
-    for (int i = 0; i < header_new->nlibs; i++) {
-        printf("libs_new[%d].flags: %p\n", i, libs_new[i].flags);
-        printf("libs_new[%d].key: %s\n", i, &strtab[libs_new[i].key]);
-        printf("libs_new[%d].value: %s\n", i, &strtab[libs_new[i].value]);
-        printf("libs_new[%d].osversion: %d\n", i, libs_new[i].osversion);
-        printf("libs_new[%d].hwcap: %ld\n", i, libs_new[i].hwcap);
+    /* In scan mode, every argument names a cache (or a root filesystem
+     * holding one) to dump. */
+    if (scan) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        if (jobs < 1) {
+            jobs = 1;
+        }
+        int failed = scanCaches(&out, &opts, argv + optind, argc - optind,
+                                rootfs, jobs);
+        flushOutput(&out);
+        return failed ? EXIT_FAILURE : 0;
+    }
+
+    char msg[PATH_MAX + 128];
+    struct ldcache *cache = loadCache(opts.path, &opts, msg, sizeof(msg));
+    if (cache == NULL) {
+        errx(EXIT_FAILURE, "%s", msg);
+    }
+
+    /* With no sonames given, dump the headers and every entry. */
+    if (optind == argc) {
+        int ret = dumpCache(&out, cache, &opts, opts.path, false);
+        if (ret != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "error parsing '%s': %s",
+                opts.path, ldcache_strerror(ret));
+        }
+        flushOutput(&out);
+        ldcache_close(cache);
+        return 0;
+    }
+
+    /* Look sonames up through the index file, which is rebuilt
+     * whenever it no longer matches the cache. Failing to write it
+     * just costs this run an in-memory index. */
+    if (opts.index != NULL) {
+        int ret = ldcache_index_file(cache, opts.index,
+                                     LDCACHE_INDEX_REBUILD);
+        if (ret == LDCACHE_ERROR_OPEN) {
+            warn("cannot write index '%s'", opts.index);
+        } else if (ret != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "error indexing '%s': %s",
+                opts.path, ldcache_strerror(ret));
+        }
+    }
+
+    /* Otherwise, print the entries matching each soname (or pattern,
+     * with -g). */
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        struct ldcache_entry entries[16];
+        size_t nfound;
+
+        int ret = query(cache, argv[i], entries, 16, &nfound);
+        if (ret == LDCACHE_ERROR_NOTFOUND) {
+            warnx("'%s' not found in '%s'", argv[i], opts.path);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (ret != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "error parsing '%s': %s",
+                opts.path, ldcache_strerror(ret));
+        }
+
+        /* Retry with enough room for every match if needed. */
+        struct ldcache_entry *found = entries;
+        if (nfound > 16) {
+            found = malloc(nfound * sizeof(*found));
+            if (found == NULL) {
+                err(EXIT_FAILURE, "malloc() failed");
+            }
+            query(cache, argv[i], found, nfound, &nfound);
+        }
+
+        for (size_t j = 0; j < nfound; j++) {
+            if (opts.filter &&
+                ldcache_flags_arch(found[j].flags) != opts.arch) {
+                continue;
+            }
+            printEntry(&out, &opts, NULL, &found[j]);
+        }
+
+        if (found != entries) {
+            free(found);
+        }
     }
 
-    free(buffer);
-    fclose(file);
-    return 0;
+    flushOutput(&out);
+    ldcache_close(cache);
+    return status;
 }
@@ -0,0 +1,215 @@
+#ifndef LDCACHE_H
+#define LDCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LDCACHE_DEFAULT_PATH "/etc/ld.so.cache"
+
+/* Error codes returned by the ldcache_*() functions. When
+ * LDCACHE_ERROR_OPEN or LDCACHE_ERROR_MMAP is returned, errno is left
+ * set to the value reported by the failing system call. */
+enum ldcache_error {
+    LDCACHE_SUCCESS = 0,
+    LDCACHE_ERROR_INVAL,    /* Invalid argument. */
+    LDCACHE_ERROR_OPEN,     /* Opening or stat'ing the cache failed. */
+    LDCACHE_ERROR_MMAP,     /* Mapping the cache into memory failed. */
+    LDCACHE_ERROR_NOMEM,    /* Memory allocation failed. */
+    LDCACHE_ERROR_FORMAT,   /* The cache is malformed. */
+    LDCACHE_ERROR_NOTFOUND, /* No entry matched the query. */
+};
+
+/* Flags for ldcache_open(). The LDCACHE_MAP_* flags control how the
+ * cache mapping is faulted in. By default pages are faulted lazily as
+ * they are touched. */
+#define LDCACHE_MAP_POPULATE   0x0001 /* MAP_POPULATE: prefault the file. */
+#define LDCACHE_MAP_WILLNEED   0x0002 /* MADV_WILLNEED: async readahead. */
+#define LDCACHE_MAP_SEQUENTIAL 0x0004 /* MADV_SEQUENTIAL */
+#define LDCACHE_MAP_RANDOM     0x0008 /* MADV_RANDOM */
+
+/* Build a hash index over the entry keys at open time so that
+ * ldcache_lookup() runs in constant time. Without it, lookups binary
+ * search the entries in ldconfig's sort order, which needs no setup,
+ * and only fall back to a linear scan if the cache turns out not to be
+ * sorted. The index is worthwhile when a handle serves many lookups. */
+#define LDCACHE_INDEX          0x0010
+
+/* Partition the entries by architecture at open time, for
+ * ldcache_arch_view(). Otherwise the partition is built on first use. */
+#define LDCACHE_ARCH_VIEWS     0x0020
+
+/* Only validate the headers and region bounds at open time, deferring
+ * the checks on each entry's string offsets until it is accessed. This
+ * makes opening O(1) for callers that only look at a few entries.
+ * Accessing a malformed entry then fails with LDCACHE_ERROR_FORMAT,
+ * and no string read ever runs past the end of the cache. */
+#define LDCACHE_LAZY           0x0040
+
+/* The low byte of an entry's flags holds the library type. */
+#define LDCACHE_FLAG_TYPE_MASK  0x00ff
+#define LDCACHE_FLAG_LIBC4      0x0000
+#define LDCACHE_FLAG_ELF        0x0001
+#define LDCACHE_FLAG_ELF_LIBC5  0x0002
+#define LDCACHE_FLAG_ELF_LIBC6  0x0003
+
+/* The high byte holds the architecture (ABI) the library requires.
+ * ldcache_arch values are this byte shifted down, so they match
+ * ldconfig's FLAG_*_LIB* constants. LDCACHE_ARCH_NONE is used for
+ * the default ABI of the host, e.g. i386 libraries on x86. */
+#define LDCACHE_FLAG_ARCH_MASK  0xff00
+#define LDCACHE_FLAG_ARCH_SHIFT 8
+
+enum ldcache_arch {
+    LDCACHE_ARCH_NONE = 0,
+    LDCACHE_ARCH_SPARC_LIB64,
+    LDCACHE_ARCH_IA64_LIB64,
+    LDCACHE_ARCH_X8664_LIB64,
+    LDCACHE_ARCH_S390_LIB64,
+    LDCACHE_ARCH_POWERPC_LIB64,
+    LDCACHE_ARCH_MIPS64_LIBN32,
+    LDCACHE_ARCH_MIPS64_LIBN64,
+    LDCACHE_ARCH_X8664_LIBX32,
+    LDCACHE_ARCH_ARM_LIBHF,
+    LDCACHE_ARCH_AARCH64_LIB64,
+    LDCACHE_ARCH_ARM_LIBSF,
+    LDCACHE_ARCH_MIPS_LIB32_NAN2008,
+    LDCACHE_ARCH_MIPS64_LIBN32_NAN2008,
+    LDCACHE_ARCH_MIPS64_LIBN64_NAN2008,
+    LDCACHE_ARCH_RISCV_FLOAT_ABI_SOFT,
+    LDCACHE_ARCH_RISCV_FLOAT_ABI_DOUBLE,
+    LDCACHE_ARCH_LARCH_FLOAT_ABI_SOFT,
+    LDCACHE_ARCH_LARCH_FLOAT_ABI_DOUBLE,
+    LDCACHE_ARCH_UNKNOWN, /* Any architecture byte not listed above. */
+    LDCACHE_NARCH,
+};
+
+/* A single library entry from the cache. The 'key' (the soname) and
+ * 'value' (the path of the library) strings point directly into the
+ * cache mapping and remain valid until ldcache_close() is called. */
+struct ldcache_entry {
+    uint32_t index;     /* Position of the entry in the cache. */
+    int32_t flags;      /* Flags bits determine arch and library type. */
+    uint32_t osversion; /* Required OS version. */
+    uint64_t hwcap;     /* Hwcap entry. */
+    const char *key;
+    const char *value;
+};
+
+/* Layouts of ld.so.cache that can be parsed. */
+enum ldcache_format {
+    LDCACHE_FORMAT_COMPAT, /* New format embedded in the old one. */
+    LDCACHE_FORMAT_NEW,    /* New format only (glibc 2.32+ default). */
+};
+
+/* Summary of the headers found in the cache. The old_* fields are
+ * only set for LDCACHE_FORMAT_COMPAT caches. */
+struct ldcache_info {
+    enum ldcache_format format;
+    char old_magic[12];   /* NUL-terminated copy of the old magic. */
+    uint32_t old_nlibs;
+    char new_magic[21];   /* NUL-terminated copy of the new magic. */
+    uint32_t new_nlibs;
+    uint32_t stringslen;
+    size_t filelen;
+};
+
+struct ldcache;
+
+/* Map and validate the cache at 'path' (LDCACHE_DEFAULT_PATH if NULL).
+ * On success '*cache' holds a handle that must be released with
+ * ldcache_close(). */
+int ldcache_open(struct ldcache **cache, const char *path, int flags);
+void ldcache_close(struct ldcache *cache);
+
+/* Bring the handle up to date with the file at the path it was opened
+ * from. If the file's device, inode, size and modification time all
+ * match the mapped snapshot this returns immediately after a single
+ * stat(). Otherwise the file is remapped and re-indexed with the
+ * original open flags, and '*changed' (if not NULL) is set to 1.
+ * Entries and views obtained before a reload become invalid. If the
+ * reload fails, the handle keeps serving the old snapshot and the
+ * error is returned. */
+int ldcache_refresh(struct ldcache *cache, int *changed);
+
+/* Check the string offsets of every entry, using vectorized bounds
+ * checks where the CPU supports them. This is what ldcache_open() does
+ * unless LDCACHE_LAZY is given. On LDCACHE_ERROR_FORMAT, the index of
+ * the first bad entry is stored in '*bad' (if not NULL). Once a handle
+ * has been validated, entries are no longer checked on access. */
+int ldcache_validate(struct ldcache *cache, size_t *bad);
+
+/* Flags for ldcache_index_file(). */
+#define LDCACHE_INDEX_REBUILD 0x0001 /* Rewrite a missing or stale file. */
+
+/* Use the precompiled hash index stored at 'path' for lookups, instead
+ * of building one in memory. The file is mapped, so a process can
+ * query it straight away, and only the slots a lookup probes are ever
+ * read. Index files are tagged with the device, inode, size and
+ * modification time of the cache they were built from, and are only
+ * used if the tag matches the mapped cache.
+ *
+ * If the file is missing, LDCACHE_ERROR_OPEN is returned; if it is
+ * stale or malformed, LDCACHE_ERROR_FORMAT. With LDCACHE_INDEX_REBUILD
+ * the index is built in memory instead and written to a temporary
+ * file, which is then renamed to 'path'. If only writing it fails, the
+ * handle still gets the in-memory index, and LDCACHE_ERROR_OPEN is
+ * returned with errno set. ldcache_refresh() reapplies the index file
+ * after reloading the cache. */
+int ldcache_index_file(struct ldcache *cache, const char *path, int flags);
+
+/* Return a static string describing an ldcache_error code. */
+const char *ldcache_strerror(int error);
+
+int ldcache_info(const struct ldcache *cache, struct ldcache_info *info);
+
+/* Return the number of library entries held in the cache. */
+size_t ldcache_count(const struct ldcache *cache);
+
+/* Fill 'entry' with the library entry at position 'index'. */
+int ldcache_entry(const struct ldcache *cache, size_t index,
+                  struct ldcache_entry *entry);
+
+/* Find all entries whose key matches 'soname'. Up to 'max' matches are
+ * stored in 'entries' (which may be NULL if 'max' is 0) in cache order,
+ * and the total number of matches is stored in '*nfound'. Returns
+ * LDCACHE_ERROR_NOTFOUND if there are no matches at all. */
+int ldcache_lookup(struct ldcache *cache, const char *soname,
+                   struct ldcache_entry *entries, size_t max,
+                   size_t *nfound);
+
+/* Like ldcache_lookup(), but find all entries whose key matches the
+ * fnmatch() pattern 'pattern' (e.g. "libnvidia-*.so.*"). Rather than
+ * matching every key, the string table is scanned with vectorized
+ * substring search for the longest literal part of the pattern, and
+ * only the entries whose keys contain it are matched. */
+int ldcache_search(struct ldcache *cache, const char *pattern,
+                   struct ldcache_entry *entries, size_t max,
+                   size_t *nfound);
+
+/* Decode the architecture from an entry's flags. */
+enum ldcache_arch ldcache_flags_arch(int32_t flags);
+
+/* Return the architecture ldconfig records for an ELF object with the
+ * given EI_CLASS, e_machine and e_flags, i.e. the one whose entries can
+ * satisfy the object's dependencies. Returns LDCACHE_ARCH_NONE for the
+ * host's default ABI and for machines ldconfig has no flag for. */
+enum ldcache_arch ldcache_elf_arch(int elfclass, int machine,
+                                   uint32_t flags);
+
+/* Return a short name for 'arch' (e.g. "x86-64"), or NULL if 'arch' is
+ * out of range. ldcache_arch_parse() does the reverse mapping. */
+const char *ldcache_arch_name(enum ldcache_arch arch);
+int ldcache_arch_parse(const char *name, enum ldcache_arch *arch);
+
+/* Format 'flags' the way 'ldconfig -p' does (e.g. "libc6,x86-64") into
+ * 'buf', truncating to 'len' bytes. Returns the untruncated length, as
+ * snprintf() does. */
+int ldcache_flags_str(int32_t flags, char *buf, size_t len);
+
+/* Return the indices of all entries for architecture 'arch', in cache
+ * order, without visiting entries of other architectures. The array
+ * is owned by the handle and valid until ldcache_close(). */
+int ldcache_arch_view(struct ldcache *cache, enum ldcache_arch arch,
+                      const uint32_t **indices, size_t *count);
+
+#endif /* LDCACHE_H */
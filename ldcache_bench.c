@@ -0,0 +1,782 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ldcache.h"
+#include "outbuf.h"
+
+/* ldcache_bench generates a synthetic ld.so.cache (or takes an existing
+ * one with -f) and times the operations the tools spend their time in:
+ * opening with and without validation and indexing, dumping every
+ * entry, and random soname lookups.
+ *
+ * For each phase it reports the time per operation and the memory
+ * touched per operation. The latter is measured as minor page faults
+ * taken on fresh mappings of the (page cached) file, plus those on any
+ * heap the library allocates, so it counts each page the first time it
+ * is touched rather than every byte read. */
+
+#define CACHEMAGIC_OLD "ld.so-1.7.0"
+#define CACHEMAGIC_NEW "glibc-ld.so.cache1.1"
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CACHE_FLAGS_ENDIAN_HOST 0x03
+#else
+#define CACHE_FLAGS_ENDIAN_HOST 0x02
+#endif
+
+/* On-disk layout, as described in libldcache.c. */
+struct header_old
+{
+  char magic[sizeof(CACHEMAGIC_OLD) - 1];
+  uint32_t nlibs;
+};
+
+struct libentry_old
+{
+  int32_t flags;
+  uint32_t key;
+  uint32_t value;
+};
+
+struct header_new
+{
+  char magic[sizeof(CACHEMAGIC_NEW) - 1];
+  uint32_t nlibs;
+  uint32_t stringslen;
+  uint8_t flags;
+  uint8_t padding[3];
+  uint32_t extension_offset;
+  uint32_t unused[3];
+};
+
+struct libentry_new
+{
+  int32_t flags;
+  uint32_t key;
+  uint32_t value;
+  uint32_t osversion;
+  uint64_t hwcap;
+};
+
+struct options
+{
+  const char *path;    /* Existing cache to benchmark, or NULL. */
+  const char *output;  /* Where to keep the generated cache, or NULL. */
+  size_t nentries;
+  size_t keylen;       /* Length of each soname. */
+  size_t dirlen;       /* Length of the directory part of each path. */
+  unsigned weights[LDCACHE_NARCH]; /* Relative share of each arch. */
+  bool compat;         /* Generate the old format with the new embedded. */
+  size_t nlookups;
+  int iterations;
+  uint64_t seed;
+};
+
+/* A generated entry. The key is the tail of the value, which is how
+ * ldconfig lays out the string table too. */
+struct gen_entry
+{
+  char *value;
+  const char *key;
+  int32_t flags;
+};
+
+static uint64_t rngState;
+
+static uint64_t rng(void)
+{
+    /* xorshift64*, so that runs with the same seed are repeatable. */
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545f4914f6cdd1dULL;
+}
+
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static long minorFaults(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+
+/* Parse "arch[:weight],..." into 'weights', e.g. "x86-64:4,none:1". */
+bool parseArchMix(const char *str, unsigned *weights)
+{
+    char *copy = strdup(str);
+    if (copy == NULL) {
+        err(EXIT_FAILURE, "strdup() failed");
+    }
+
+    memset(weights, 0, LDCACHE_NARCH * sizeof(*weights));
+
+    bool ok = true;
+    char *save;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        unsigned weight = 1;
+        char *colon = strchr(tok, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            char *end;
+            weight = strtoul(colon + 1, &end, 10);
+            if (*end != '\0') {
+                ok = false;
+                break;
+            }
+        }
+
+        enum ldcache_arch arch;
+        if (ldcache_arch_parse(tok, &arch) != LDCACHE_SUCCESS ||
+            arch == LDCACHE_ARCH_UNKNOWN) {
+            ok = false;
+            break;
+        }
+        weights[arch] += weight;
+    }
+
+    free(copy);
+    return ok;
+}
+
+
+/* ldconfig's sort order (glibc's _dl_cache_libcmp()), as used by
+ * libldcache to binary search the entries. */
+static int libcmp(const char *p1, const char *p2)
+{
+    while (*p1 != '\0') {
+        if (*p1 >= '0' && *p1 <= '9') {
+            if (*p2 >= '0' && *p2 <= '9') {
+                int val1 = *p1++ - '0';
+                int val2 = *p2++ - '0';
+                while (*p1 >= '0' && *p1 <= '9')
+                    val1 = val1 * 10 + *p1++ - '0';
+                while (*p2 >= '0' && *p2 <= '9')
+                    val2 = val2 * 10 + *p2++ - '0';
+                if (val1 != val2)
+                    return val1 - val2;
+            } else {
+                return 1;
+            }
+        } else if (*p2 >= '0' && *p2 <= '9') {
+            return -1;
+        } else if (*p1 != *p2) {
+            return *p1 - *p2;
+        } else {
+            p1++;
+            p2++;
+        }
+    }
+    return *p1 - *p2;
+}
+
+
+/* Sort entries the way ldconfig does: descending by soname, then by
+ * flags. */
+static int compareEntries(const void *a, const void *b)
+{
+    const struct gen_entry *ea = a;
+    const struct gen_entry *eb = b;
+
+    int ret = libcmp(eb->key, ea->key);
+    if (ret != 0) {
+        return ret;
+    }
+    return (eb->flags > ea->flags) - (eb->flags < ea->flags);
+}
+
+
+static enum ldcache_arch pickArch(const unsigned *weights, unsigned total)
+{
+    unsigned r = rng() % total;
+    for (int a = 0; a < LDCACHE_NARCH; a++) {
+        if (r < weights[a]) {
+            return a;
+        }
+        r -= weights[a];
+    }
+    return LDCACHE_ARCH_NONE;
+}
+
+
+/* Make 'nentries' distinct entries. Each soname is "lib", random
+ * lowercase padding, a base-26 serial number that keeps it unique, and
+ * a ".so.N" suffix, 'keylen' bytes in all. */
+struct gen_entry *generateEntries(const struct options *opts)
+{
+    struct gen_entry *entries = calloc(opts->nentries, sizeof(*entries));
+    if (entries == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
+    }
+
+    unsigned total = 0;
+    for (int a = 0; a < LDCACHE_NARCH; a++) {
+        total += opts->weights[a];
+    }
+
+    size_t serialw = 1;
+    for (size_t n = opts->nentries; n >= 26; n /= 26) {
+        serialw++;
+    }
+
+    for (size_t i = 0; i < opts->nentries; i++) {
+        enum ldcache_arch arch = pickArch(opts->weights, total);
+        const char *name = ldcache_arch_name(arch);
+
+        char *value = malloc(opts->dirlen + opts->keylen + 1);
+        if (value == NULL) {
+            err(EXIT_FAILURE, "malloc() failed");
+        }
+
+        /* "/usr/lib/<arch>/", cut or padded out to 'dirlen' with 'x'. */
+        char *p = value;
+        snprintf(p, opts->dirlen, "/usr/lib/%s", name);
+        p += strlen(p);
+        while (p < value + opts->dirlen - 1) {
+            *p++ = 'x';
+        }
+        *p++ = '/';
+
+        char *key = p;
+        memcpy(p, "lib", 3);
+        p += 3;
+        size_t pad = opts->keylen - 3 - serialw - 5;
+        for (size_t j = 0; j < pad; j++) {
+            *p++ = 'a' + rng() % 26;
+        }
+        size_t serial = i;
+        for (size_t j = serialw; j > 0; j--) {
+            p[j - 1] = 'a' + serial % 26;
+            serial /= 26;
+        }
+        p += serialw;
+        memcpy(p, ".so.", 4);
+        p[4] = '0' + rng() % 10;
+        p[5] = '\0';
+
+        entries[i].value = value;
+        entries[i].key = key;
+        entries[i].flags = LDCACHE_FLAG_ELF_LIBC6 |
+                           (arch << LDCACHE_FLAG_ARCH_SHIFT);
+    }
+
+    qsort(entries, opts->nentries, sizeof(*entries), compareEntries);
+    return entries;
+}
+
+
+/* Write 'entries' to 'path' in the layout ldconfig uses, with the
+ * string table after the new format entries. */
+void writeCache(const struct options *opts, const struct gen_entry *entries,
+                const char *path)
+{
+    size_t n = opts->nentries;
+    size_t stringslen = n * (opts->dirlen + opts->keylen + 1);
+
+    size_t oldlen = 0;
+    if (opts->compat) {
+        oldlen = sizeof(struct header_old) + n * sizeof(struct libentry_old);
+        oldlen = (oldlen + __alignof__(struct header_new) - 1) &
+                 ~(__alignof__(struct header_new) - 1);
+    }
+    size_t strstart = sizeof(struct header_new) +
+                      n * sizeof(struct libentry_new);
+    if (strstart + stringslen > UINT32_MAX) {
+        errx(EXIT_FAILURE, "cache would exceed 4 GiB");
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "open '%s' failed", path);
+    }
+
+    struct outbuf out;
+    if (outbuf_init(&out, fd, 0) == -1) {
+        err(EXIT_FAILURE, "malloc() failed");
+    }
+
+    if (opts->compat) {
+        /* Old entries index the old string table, which starts right
+         * after them, i.e. before the padding and the new header. */
+        size_t oldstr = sizeof(struct header_old) +
+                        n * sizeof(struct libentry_old);
+        uint32_t delta = oldlen - oldstr + strstart;
+
+        struct header_old hdr = { .nlibs = n };
+        memcpy(hdr.magic, CACHEMAGIC_OLD, sizeof(hdr.magic));
+        outbuf_write(&out, &hdr, sizeof(hdr));
+
+        for (size_t i = 0; i < n; i++) {
+            uint32_t value = i * (opts->dirlen + opts->keylen + 1);
+            struct libentry_old lib = {
+                .flags = entries[i].flags,
+                .key = delta + value + opts->dirlen,
+                .value = delta + value,
+            };
+            outbuf_write(&out, &lib, sizeof(lib));
+        }
+
+        static const char zeros[8];
+        outbuf_write(&out, zeros, oldlen - oldstr);
+    }
+
+    struct header_new hdr = {
+        .nlibs = n,
+        .stringslen = stringslen,
+        .flags = CACHE_FLAGS_ENDIAN_HOST,
+    };
+    memcpy(hdr.magic, CACHEMAGIC_NEW, sizeof(hdr.magic));
+    outbuf_write(&out, &hdr, sizeof(hdr));
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t value = strstart + i * (opts->dirlen + opts->keylen + 1);
+        struct libentry_new lib = {
+            .flags = entries[i].flags,
+            .key = value + opts->dirlen,
+            .value = value,
+        };
+        outbuf_write(&out, &lib, sizeof(lib));
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        outbuf_write(&out, entries[i].value,
+                     opts->dirlen + opts->keylen + 1);
+    }
+
+    if (outbuf_flush(&out) == -1) {
+        err(EXIT_FAILURE, "write '%s' failed", path);
+    }
+    outbuf_free(&out);
+    if (close(fd) == -1) {
+        err(EXIT_FAILURE, "close '%s' failed", path);
+    }
+}
+
+
+struct ldcache *openCache(const char *path, int flags)
+{
+    struct ldcache *cache;
+    int ret = ldcache_open(&cache, path, flags);
+    if (ret == LDCACHE_ERROR_OPEN || ret == LDCACHE_ERROR_MMAP) {
+        err(EXIT_FAILURE, "error loading '%s'", path);
+    }
+    if (ret != LDCACHE_SUCCESS) {
+        errx(EXIT_FAILURE, "error parsing '%s': %s",
+            path, ldcache_strerror(ret));
+    }
+    return cache;
+}
+
+
+/* Accumulated cost of one benchmark phase. */
+struct phase
+{
+  const char *name;
+  uint64_t ns;
+  long faults;
+  size_t ops;
+};
+
+void report(const struct phase *p)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    double ops = p->ops ? p->ops : 1;
+
+    printf("%-16s %10zu %12.1f %14.1f\n", p->name, p->ops,
+           p->ns / ops, p->faults * pagesize / ops);
+}
+
+
+/* Open and close the cache, the whole cost of a one-shot tool run
+ * minus the process startup. */
+void benchOpen(const struct options *opts, const char *path,
+               const char *name, int flags)
+{
+    struct phase p = { .name = name };
+
+    for (int i = 0; i < opts->iterations; i++) {
+        long faults = minorFaults();
+        uint64_t start = now();
+        struct ldcache *cache = openCache(path, flags);
+        ldcache_close(cache);
+        p.ns += now() - start;
+        p.faults += minorFaults() - faults;
+        p.ops++;
+    }
+    report(&p);
+}
+
+
+void benchValidate(const struct options *opts, const char *path)
+{
+    struct phase p = { .name = "validate" };
+
+    for (int i = 0; i < opts->iterations; i++) {
+        struct ldcache *cache = openCache(path, LDCACHE_LAZY);
+
+        long faults = minorFaults();
+        uint64_t start = now();
+        size_t bad;
+        int ret = ldcache_validate(cache, &bad);
+        p.ns += now() - start;
+        p.faults += minorFaults() - faults;
+        p.ops++;
+
+        if (ret != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "entry %zu of '%s' is invalid", bad, path);
+        }
+        ldcache_close(cache);
+    }
+    report(&p);
+}
+
+
+/* Format every entry the way 'ldcache -o tsv' does, into a buffer that
+ * is thrown away. Timed per entry. */
+void benchDump(const struct options *opts, const char *path)
+{
+    struct phase p = { .name = "dump" };
+
+    struct outbuf out;
+    if (outbuf_init(&out, -1, 0) == -1) {
+        err(EXIT_FAILURE, "malloc() failed");
+    }
+
+    for (int i = 0; i < opts->iterations; i++) {
+        struct ldcache *cache = openCache(path, 0);
+        size_t count = ldcache_count(cache);
+
+        long faults = minorFaults();
+        uint64_t start = now();
+        for (size_t j = 0; j < count; j++) {
+            struct ldcache_entry entry;
+            char flags[64];
+
+            ldcache_entry(cache, j, &entry);
+            ldcache_flags_str(entry.flags, flags, sizeof(flags));
+
+            outbuf_u64(&out, entry.index);
+            outbuf_write(&out, "\t0x", 3);
+            outbuf_hex(&out, (uint32_t)entry.flags, 4);
+            outbuf_char(&out, '\t');
+            outbuf_str(&out, flags);
+            outbuf_char(&out, '\t');
+            outbuf_str(&out, entry.key);
+            outbuf_char(&out, '\t');
+            outbuf_str(&out, entry.value);
+            outbuf_char(&out, '\t');
+            outbuf_u64(&out, entry.osversion);
+            outbuf_write(&out, "\t0x", 3);
+            outbuf_hex(&out, entry.hwcap, 16);
+            outbuf_char(&out, '\n');
+
+            /* Keep the buffer from growing past its first size. */
+            if (out.len > out.cap / 2) {
+                out.len = 0;
+            }
+        }
+        p.ns += now() - start;
+        p.faults += minorFaults() - faults;
+        p.ops += count;
+        out.len = 0;
+
+        ldcache_close(cache);
+    }
+
+    outbuf_free(&out);
+    report(&p);
+}
+
+
+/* Look up 'nlookups' sonames picked at random from the cache, on a
+ * handle opened with 'flags' and using the index file 'index' if not
+ * NULL. Timed per lookup, including the open. */
+void benchLookup(const struct options *opts, const char *path,
+                 const char *name, int flags, const char *index,
+                 char **keys, size_t nkeys)
+{
+    struct phase p = { .name = name };
+
+    for (int i = 0; i < opts->iterations; i++) {
+        long faults = minorFaults();
+        uint64_t start = now();
+        struct ldcache *cache = openCache(path, flags);
+        if (index != NULL &&
+            ldcache_index_file(cache, index, 0) != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "cannot use index '%s'", index);
+        }
+
+        for (size_t j = 0; j < opts->nlookups; j++) {
+            struct ldcache_entry entries[4];
+            size_t nfound;
+            const char *key = keys[rng() % nkeys];
+
+            if (ldcache_lookup(cache, key, entries, 4,
+                               &nfound) != LDCACHE_SUCCESS) {
+                errx(EXIT_FAILURE, "lookup of '%s' failed", key);
+            }
+        }
+
+        ldcache_close(cache);
+        p.ns += now() - start;
+        p.faults += minorFaults() - faults;
+        p.ops += opts->nlookups;
+    }
+    report(&p);
+}
+
+
+/* Copy the cache's sonames out, so that lookups are not helped by the
+ * key already being in the cache mapping. */
+char **collectKeys(const char *path, size_t *nkeys)
+{
+    struct ldcache *cache = openCache(path, 0);
+    size_t count = ldcache_count(cache);
+    if (count == 0) {
+        errx(EXIT_FAILURE, "'%s' has no entries", path);
+    }
+
+    char **keys = calloc(count, sizeof(*keys));
+    if (keys == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct ldcache_entry entry;
+        ldcache_entry(cache, i, &entry);
+        keys[i] = strdup(entry.key);
+        if (keys[i] == NULL) {
+            err(EXIT_FAILURE, "strdup() failed");
+        }
+    }
+
+    ldcache_close(cache);
+    *nkeys = count;
+    return keys;
+}
+
+
+size_t parseSize(const char *str, const char *what)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    /* Allow a k or M suffix for entry and lookup counts. */
+    if (*end == 'k') {
+        value *= 1000;
+        end++;
+    } else if (*end == 'M') {
+        value *= 1000000;
+        end++;
+    }
+    if (errno != 0 || end == str || *end != '\0' || value > SIZE_MAX) {
+        errx(EXIT_FAILURE, "invalid %s '%s'", what, str);
+    }
+    return value;
+}
+
+
+void usage(const char *prog)
+{
+    errx(EXIT_FAILURE, "usage: %s [-n entries] [-k keylen] [-d dirlen] "
+        "[-a arch[:weight],...] [-c] [-r lookups] [-i iterations] "
+        "[-s seed] [-o output]\n"
+        "       %s -f cache [-r lookups] [-i iterations] [-s seed]",
+        prog, prog);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct options opts = {
+        .nentries = 10000,
+        .keylen = 16,
+        .dirlen = 24,
+        .nlookups = 100000,
+        .iterations = 10,
+        .seed = 1,
+    };
+    parseArchMix("x86-64:4,none:1", opts.weights);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:cd:f:i:k:n:o:r:s:")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (!parseArchMix(optarg, opts.weights)) {
+                    errx(EXIT_FAILURE, "invalid arch mix '%s'", optarg);
+                }
+                break;
+            case 'c':
+                opts.compat = true;
+                break;
+            case 'd':
+                opts.dirlen = parseSize(optarg, "directory length");
+                break;
+            case 'f':
+                opts.path = optarg;
+                break;
+            case 'i':
+                opts.iterations = parseSize(optarg, "iteration count");
+                break;
+            case 'k':
+                opts.keylen = parseSize(optarg, "key length");
+                break;
+            case 'n':
+                opts.nentries = parseSize(optarg, "entry count");
+                break;
+            case 'o':
+                opts.output = optarg;
+                break;
+            case 'r':
+                opts.nlookups = parseSize(optarg, "lookup count");
+                break;
+            case 's':
+                opts.seed = parseSize(optarg, "seed");
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+    }
+
+    unsigned total = 0;
+    for (int a = 0; a < LDCACHE_NARCH; a++) {
+        total += opts.weights[a];
+    }
+    if (total == 0) {
+        errx(EXIT_FAILURE, "arch mix has no weight");
+    }
+    if (opts.nentries == 0 || opts.nentries > UINT32_MAX) {
+        errx(EXIT_FAILURE, "entry count must be between 1 and %u",
+            UINT32_MAX);
+    }
+    if (opts.iterations < 1) {
+        opts.iterations = 1;
+    }
+    rngState = opts.seed ? opts.seed : 1;
+
+    char tmppath[] = "/tmp/ldcache-bench.XXXXXX";
+    const char *path = opts.path;
+    if (path == NULL) {
+        size_t serialw = 1;
+        for (size_t n = opts.nentries; n >= 26; n /= 26) {
+            serialw++;
+        }
+        if (opts.keylen < 3 + serialw + 5) {
+            errx(EXIT_FAILURE, "key length must be at least %zu for %zu "
+                "entries", 3 + serialw + 5, opts.nentries);
+        }
+        if (opts.dirlen < 2) {
+            errx(EXIT_FAILURE, "directory length must be at least 2");
+        }
+
+        if (opts.output != NULL) {
+            path = opts.output;
+        } else {
+            int fd = mkstemp(tmppath);
+            if (fd < 0) {
+                err(EXIT_FAILURE, "mkstemp() failed");
+            }
+            close(fd);
+            path = tmppath;
+        }
+
+        uint64_t start = now();
+        struct gen_entry *entries = generateEntries(&opts);
+        writeCache(&opts, entries, path);
+        uint64_t ns = now() - start;
+
+        for (size_t i = 0; i < opts.nentries; i++) {
+            free(entries[i].value);
+        }
+        free(entries);
+
+        fprintf(stderr, "generated %zu entries in %.1f ms\n",
+                opts.nentries, ns / 1e6);
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        err(EXIT_FAILURE, "stat '%s' failed", path);
+    }
+
+    size_t nkeys;
+    char **keys = collectKeys(path, &nkeys);
+
+    struct ldcache *cache = openCache(path, LDCACHE_LAZY);
+    struct ldcache_info info;
+    ldcache_info(cache, &info);
+    ldcache_close(cache);
+
+    printf("cache: %s (%s format, %u entries, %lld bytes)\n",
+           opts.path ? opts.path : "generated",
+           info.format == LDCACHE_FORMAT_COMPAT ? "compat" : "new",
+           info.new_nlibs, (long long)st.st_size);
+    printf("%-16s %10s %12s %14s\n", "phase", "ops", "ns/op",
+           "bytes/op");
+
+    benchOpen(&opts, path, "open", 0);
+    benchOpen(&opts, path, "open lazy", LDCACHE_LAZY);
+    benchOpen(&opts, path, "open index", LDCACHE_INDEX);
+    benchValidate(&opts, path);
+    benchDump(&opts, path);
+    if (opts.nlookups > 0) {
+        benchLookup(&opts, path, "lookup bsearch", 0, NULL, keys, nkeys);
+        benchLookup(&opts, path, "lookup index", LDCACHE_INDEX, NULL,
+                    keys, nkeys);
+
+        /* Write an index file once, then time lookups through it. */
+        char indexpath[] = "/tmp/ldcache-bench-index.XXXXXX";
+        int fd = mkstemp(indexpath);
+        if (fd < 0) {
+            err(EXIT_FAILURE, "mkstemp() failed");
+        }
+        close(fd);
+
+        cache = openCache(path, 0);
+        int ret = ldcache_index_file(cache, indexpath,
+                                     LDCACHE_INDEX_REBUILD);
+        if (ret != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "cannot write index '%s': %s",
+                indexpath, ldcache_strerror(ret));
+        }
+        ldcache_close(cache);
+
+        benchLookup(&opts, path, "lookup idxfile", 0, indexpath,
+                    keys, nkeys);
+        unlink(indexpath);
+    }
+
+    for (size_t i = 0; i < nkeys; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+
+    if (path == tmppath) {
+        unlink(tmppath);
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "ldcache_simd.h"
+
+typedef const char *(*find_literal_fn)(const char *, size_t,
+                                       const char *, size_t);
+
+static const char *findLiteralScalar(const char *hay, size_t haylen,
+                                     const char *needle, size_t nlen)
+{
+    return memmem(hay, haylen, needle, nlen);
+}
+
+
+#if defined(__x86_64__)
+
+/* The ldcache_find_literal() vector kernels compare a block of
+ * candidate start positions against the first byte of the needle, and
+ * the same block shifted by 'nlen - 1' against its last byte. Only
+ * positions matching both are verified with memcmp(), which rejects
+ * almost every false start in the string table after two compares per
+ * 16 (or 32) bytes. Whatever is left over at the end is handed to the
+ * scalar kernel. */
+
+static const char *findLiteralSSE2(const char *hay, size_t haylen,
+                                   const char *needle, size_t nlen)
+{
+    if (haylen < nlen) {
+        return NULL;
+    }
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    size_t end = haylen - nlen + 1; /* Number of candidate positions. */
+    size_t i = 0;
+
+    for (; i + 16 <= end; i += 16) {
+        __m128i bfirst = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i blast = _mm_loadu_si128((const __m128i *)(hay + i + nlen - 1));
+        uint32_t mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(bfirst, first),
+                          _mm_cmpeq_epi8(blast, last)));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, nlen - 1) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return findLiteralScalar(hay + i, haylen - i, needle, nlen);
+}
+
+
+__attribute__((target("avx2")))
+static const char *findLiteralAVX2(const char *hay, size_t haylen,
+                                   const char *needle, size_t nlen)
+{
+    if (haylen < nlen) {
+        return NULL;
+    }
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+    size_t end = haylen - nlen + 1; /* Number of candidate positions. */
+    size_t i = 0;
+
+    for (; i + 32 <= end; i += 32) {
+        __m256i bfirst = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i blast = _mm256_loadu_si256(
+            (const __m256i *)(hay + i + nlen - 1));
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(bfirst, first),
+                             _mm256_cmpeq_epi8(blast, last)));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, nlen - 1) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return findLiteralSSE2(hay + i, haylen - i, needle, nlen);
+}
+
+#endif /* __x86_64__ */
+
+
+static find_literal_fn resolveFindLiteral(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return findLiteralAVX2;
+    }
+    return findLiteralSSE2;
+#else
+    return findLiteralScalar;
+#endif
+}
+
+
+const char *ldcache_find_literal(const char *hay, size_t haylen,
+                                 const char *needle, size_t nlen)
+{
+    /* Every thread resolves to the same kernel, so racing on the first
+     * call is harmless. */
+    static find_literal_fn impl;
+
+    find_literal_fn fn = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (fn == NULL) {
+        fn = resolveFindLiteral();
+        __atomic_store_n(&impl, fn, __ATOMIC_RELAXED);
+    }
+    return fn(hay, haylen, needle, nlen);
+}
+
+
+typedef size_t (*find_bad_offset_fn)(const void *, size_t, size_t,
+                                     size_t, uint32_t);
+
+static size_t findBadOffsetScalar(const void *base, size_t n, size_t stride,
+                                  size_t fieldoff, uint32_t limit)
+{
+    const char *p = (const char *)base + fieldoff;
+
+    for (size_t i = 0; i < n; i++, p += stride) {
+        uint32_t off[2];
+        memcpy(off, p, sizeof(off));
+        if (off[0] >= limit || off[1] >= limit) {
+            return i;
+        }
+    }
+    return n;
+}
+
+
+#if defined(__x86_64__)
+
+/* Both vector kernels compare unsigned offsets, which SSE/AVX lack a
+ * direct instruction for: x >= limit exactly when max(x, limit) == x.
+ * Blocks with a bad lane report the lowest such lane, which is the
+ * first bad record since lanes are in record order. */
+
+/* SSE4.1 has no gather, so load 16 bytes from each of four records
+ * (the offset pair is at the start of each load) and transpose them
+ * into a vector of first offsets and a vector of second offsets. */
+__attribute__((target("sse4.1")))
+static size_t findBadOffsetSSE41(const void *base, size_t n, size_t stride,
+                                 size_t fieldoff, uint32_t limit)
+{
+    const char *p = (const char *)base + fieldoff;
+    const __m128i vlimit = _mm_set1_epi32(limit);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4, p += 4 * stride) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + stride));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + 2 * stride));
+        __m128i d = _mm_loadu_si128((const __m128i *)(p + 3 * stride));
+
+        __m128i ab = _mm_unpacklo_epi32(a, b); /* a0 b0 a1 b1 */
+        __m128i cd = _mm_unpacklo_epi32(c, d); /* c0 d0 c1 d1 */
+        __m128i first = _mm_unpacklo_epi64(ab, cd);
+        __m128i second = _mm_unpackhi_epi64(ab, cd);
+
+        __m128i bad = _mm_or_si128(
+            _mm_cmpeq_epi32(_mm_max_epu32(first, vlimit), first),
+            _mm_cmpeq_epi32(_mm_max_epu32(second, vlimit), second));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(bad));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + findBadOffsetScalar(p - fieldoff, n - i, stride,
+                                   fieldoff, limit);
+}
+
+
+/* AVX2 gathers the offsets of eight records at a time. */
+__attribute__((target("avx2")))
+static size_t findBadOffsetAVX2(const void *base, size_t n, size_t stride,
+                                size_t fieldoff, uint32_t limit)
+{
+    const char *p = (const char *)base + fieldoff;
+    const __m256i vlimit = _mm256_set1_epi32(limit);
+    const __m256i vindex = _mm256_mullo_epi32(
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+        _mm256_set1_epi32(stride));
+    size_t i = 0;
+
+    /* Gather indices are 32-bit, so fall back for absurd strides. */
+    if (stride > INT32_MAX / 8) {
+        return findBadOffsetScalar(base, n, stride, fieldoff, limit);
+    }
+
+    for (; i + 8 <= n; i += 8, p += 8 * stride) {
+        __m256i first = _mm256_i32gather_epi32((const int *)p, vindex, 1);
+        __m256i second = _mm256_i32gather_epi32((const int *)(p + 4),
+                                                vindex, 1);
+
+        __m256i bad = _mm256_or_si256(
+            _mm256_cmpeq_epi32(_mm256_max_epu32(first, vlimit), first),
+            _mm256_cmpeq_epi32(_mm256_max_epu32(second, vlimit), second));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(bad));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + findBadOffsetSSE41(p - fieldoff, n - i, stride,
+                                  fieldoff, limit);
+}
+
+#endif /* __x86_64__ */
+
+
+static find_bad_offset_fn resolveFindBadOffset(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return findBadOffsetAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return findBadOffsetSSE41;
+    }
+#endif
+    return findBadOffsetScalar;
+}
+
+
+size_t ldcache_find_bad_offset(const void *base, size_t n, size_t stride,
+                               size_t fieldoff, uint32_t limit)
+{
+    static find_bad_offset_fn impl;
+
+    find_bad_offset_fn fn = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (fn == NULL) {
+        fn = resolveFindBadOffset();
+        __atomic_store_n(&impl, fn, __ATOMIC_RELAXED);
+    }
+    return fn(base, n, stride, fieldoff, limit);
+}
@@ -0,0 +1,34 @@
+#ifndef LDCACHE_SIMD_H
+#define LDCACHE_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Vectorized kernels used internally by libldcache. Each kernel picks
+ * the widest implementation the running CPU supports (AVX2, then
+ * SSE4.1 or SSE2 on x86-64) the first time it is called, and falls
+ * back to portable scalar code everywhere else.
+ *
+ * They carry the library's prefix so as not to clash with the symbols
+ * of programs linking libldcache.a, and are hidden so that
+ * libldcache.so doesn't export them. */
+#define LDCACHE_HIDDEN __attribute__((visibility("hidden")))
+
+/* Return a pointer to the first occurrence of the 'nlen' byte string
+ * 'needle' within the 'haylen' bytes at 'hay', or NULL if there is none.
+ * 'nlen' must be greater than zero. */
+LDCACHE_HIDDEN
+const char *ldcache_find_literal(const char *hay, size_t haylen,
+                                 const char *needle, size_t nlen);
+
+/* Check pairs of uint32_t offsets against 'limit'. There are 'n'
+ * records laid out every 'stride' bytes from 'base', and each holds
+ * two consecutive offsets starting 'fieldoff' bytes in. Every record
+ * must have at least 16 readable bytes from 'fieldoff' on. Returns the
+ * index of the first record with an offset >= 'limit', or 'n' if all
+ * of them are in bounds. */
+LDCACHE_HIDDEN
+size_t ldcache_find_bad_offset(const void *base, size_t n, size_t stride,
+                               size_t fieldoff, uint32_t limit);
+
+#endif /* LDCACHE_SIMD_H */
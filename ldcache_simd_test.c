@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The kernels are static, so they are built into the test directly to
+ * run each one the CPU supports, and not just the one the dispatcher
+ * would pick. */
+#include "ldcache_simd.c"
+
+/* ldcache_simd_test checks every vector kernel of ldcache_simd.c
+ * against the scalar one. It prints each failed check and exits
+ * non-zero if there were any. */
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static const struct {
+    const char *name;
+    find_bad_offset_fn fn;
+    const char *cpu; /* Feature the kernel needs, or NULL. */
+} badOffsetKernels[] = {
+    { "scalar", findBadOffsetScalar, NULL },
+#if defined(__x86_64__)
+    { "sse4.1", findBadOffsetSSE41, "sse4.1" },
+    { "avx2", findBadOffsetAVX2, "avx2" },
+#endif
+    { "dispatch", ldcache_find_bad_offset, NULL },
+};
+
+static const struct {
+    const char *name;
+    find_literal_fn fn;
+    const char *cpu;
+} literalKernels[] = {
+    { "scalar", findLiteralScalar, NULL },
+#if defined(__x86_64__)
+    { "sse2", findLiteralSSE2, NULL },
+    { "avx2", findLiteralAVX2, "avx2" },
+#endif
+    { "dispatch", ldcache_find_literal, NULL },
+};
+
+
+static bool cpuHas(const char *feature)
+{
+    if (feature == NULL) {
+        return true;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (strcmp(feature, "sse4.1") == 0) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+    if (strcmp(feature, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return false;
+}
+
+
+/* Records shaped like libentry_new: the offset pair 4 bytes into each
+ * 24 byte record, followed by other fields. */
+#define STRIDE   24
+#define FIELDOFF 4
+#define LIMIT    1000
+#define MAXRECS  40
+
+static void setOffsets(unsigned char *recs, size_t i, uint32_t key,
+                       uint32_t value)
+{
+    uint32_t off[2] = { key, value };
+    memcpy(recs + i * STRIDE + FIELDOFF, off, sizeof(off));
+}
+
+
+/* Run every kernel over 'n' records with one bad offset at each record
+ * in turn, so that the bad record falls on every lane of a vector block
+ * and in the scalar tail after the last whole block. */
+static void testBadOffset(void)
+{
+    /* Each record must have 16 readable bytes from its offset pair on,
+     * which for the last one runs past its end. */
+    unsigned char *recs = malloc(MAXRECS * STRIDE + 16);
+    if (recs == NULL) {
+        abort();
+    }
+
+    static const uint32_t bad[] = { LIMIT, LIMIT + 1, UINT32_MAX };
+
+    for (size_t k = 0; k < sizeof(badOffsetKernels) /
+                           sizeof(badOffsetKernels[0]); k++) {
+        if (!cpuHas(badOffsetKernels[k].cpu)) {
+            printf("skipping %s findBadOffset kernel\n",
+                   badOffsetKernels[k].name);
+            continue;
+        }
+        find_bad_offset_fn fn = badOffsetKernels[k].fn;
+
+        for (size_t n = 0; n <= MAXRECS; n++) {
+            /* Good records, with junk around the offsets and the
+             * largest offset that is still in bounds mixed in. */
+            memset(recs, 0xff, MAXRECS * STRIDE + 16);
+            for (size_t i = 0; i < n; i++) {
+                setOffsets(recs, i, (i * 37) % LIMIT, LIMIT - 1);
+            }
+
+            size_t got = fn(recs, n, STRIDE, FIELDOFF, LIMIT);
+            CHECK(got == n, "%s: %zu good records: got %zu",
+                  badOffsetKernels[k].name, n, got);
+
+            for (size_t i = 0; i < n; i++) {
+                for (size_t b = 0; b < sizeof(bad) / sizeof(bad[0]); b++) {
+                    for (int field = 0; field < 2; field++) {
+                        setOffsets(recs, i, field == 0 ? bad[b] : 0,
+                                   field == 1 ? bad[b] : 0);
+                        got = fn(recs, n, STRIDE, FIELDOFF, LIMIT);
+                        CHECK(got == i,
+                              "%s: %zu records, offset %d of record %zu "
+                              "is %u: got %zu", badOffsetKernels[k].name,
+                              n, field, i, bad[b], got);
+
+                        /* A second bad record after the first must
+                         * not change the answer. */
+                        if (i + 1 < n) {
+                            setOffsets(recs, n - 1, bad[b], bad[b]);
+                            got = fn(recs, n, STRIDE, FIELDOFF, LIMIT);
+                            CHECK(got == i, "%s: %zu records, first bad "
+                                  "record %zu of two: got %zu",
+                                  badOffsetKernels[k].name, n, i, got);
+                            setOffsets(recs, n - 1, 0, LIMIT - 1);
+                        }
+                    }
+                }
+                setOffsets(recs, i, (i * 37) % LIMIT, LIMIT - 1);
+            }
+        }
+    }
+
+    free(recs);
+}
+
+
+/* Run every kernel over a haystack with the needle planted at each
+ * position in turn, comparing the results against memmem(). */
+static void testLiteral(void)
+{
+    static const char *const needles[] = { "x", "xzy", "libnvidia-" };
+    char hay[96];
+
+    for (size_t k = 0; k < sizeof(literalKernels) /
+                           sizeof(literalKernels[0]); k++) {
+        if (!cpuHas(literalKernels[k].cpu)) {
+            printf("skipping %s findLiteral kernel\n",
+                   literalKernels[k].name);
+            continue;
+        }
+        find_literal_fn fn = literalKernels[k].fn;
+
+        for (size_t t = 0; t < sizeof(needles) / sizeof(needles[0]); t++) {
+            const char *needle = needles[t];
+            size_t nlen = strlen(needle);
+
+            for (size_t haylen = 0; haylen <= sizeof(hay); haylen++) {
+                /* Near misses: the needle's first and last bytes in
+                 * place every 'nlen' bytes, but not the bytes between. */
+                for (size_t i = 0; i < haylen; i++) {
+                    hay[i] = nlen == 1 ? '.' :
+                             i % nlen == 0 ? needle[0] :
+                             i % nlen == nlen - 1 ? needle[nlen - 1] : '.';
+                }
+
+                const char *got = fn(hay, haylen, needle, nlen);
+                CHECK(got == NULL, "%s: '%s' in %zu bytes without it: "
+                      "found at %td", literalKernels[k].name, needle,
+                      haylen, got - hay);
+
+                for (size_t i = 0; i + nlen <= haylen; i++) {
+                    char saved[16];
+                    memcpy(saved, hay + i, nlen);
+                    memcpy(hay + i, needle, nlen);
+
+                    const char *want = memmem(hay, haylen, needle, nlen);
+                    got = fn(hay, haylen, needle, nlen);
+                    CHECK(got == want, "%s: '%s' at %zu of %zu bytes: "
+                          "found at %td", literalKernels[k].name, needle,
+                          i, haylen, got != NULL ? got - hay : -1);
+
+                    memcpy(hay + i, saved, nlen);
+                }
+            }
+        }
+    }
+}
+
+
+int main(void)
+{
+    testBadOffset();
+    testLiteral();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
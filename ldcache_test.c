@@ -0,0 +1,811 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ldcache.h"
+
+/* ldcache_test runs libldcache against small hand-built caches whose
+ * contents are known, checking that every way of opening a cache gives
+ * the same lookup results. It prints each failed check and exits
+ * non-zero if there were any. */
+
+#define CACHEMAGIC_OLD "ld.so-1.7.0"
+#define CACHEMAGIC_NEW "glibc-ld.so.cache1.1"
+#define EXTENSIONMAGIC 0xeaa42174
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CACHE_FLAGS_ENDIAN_HOST 0x03
+#else
+#define CACHE_FLAGS_ENDIAN_HOST 0x02
+#endif
+
+/* On-disk layout, as described in libldcache.c. */
+struct header_old
+{
+  char magic[sizeof(CACHEMAGIC_OLD) - 1];
+  uint32_t nlibs;
+};
+
+struct libentry_old
+{
+  int32_t flags;
+  uint32_t key;
+  uint32_t value;
+};
+
+struct header_new
+{
+  char magic[sizeof(CACHEMAGIC_NEW) - 1];
+  uint32_t nlibs;
+  uint32_t stringslen;
+  uint8_t flags;
+  uint8_t padding[3];
+  uint32_t extension_offset;
+  uint32_t unused[3];
+};
+
+struct libentry_new
+{
+  int32_t flags;
+  uint32_t key;
+  uint32_t value;
+  uint32_t osversion;
+  uint64_t hwcap;
+};
+
+/* glibc 2.33's extension section, with one section holding the name of
+ * the program that generated the cache. */
+struct extension
+{
+  uint32_t magic;
+  uint32_t count;
+  uint32_t tag;
+  uint32_t flags;
+  uint32_t offset;
+  uint32_t size;
+};
+
+#define GENERATOR "ldconfig (GNU libc) 2.36"
+
+/* Each way of opening a cache the lookups are checked with. */
+static const struct {
+    const char *name;
+    int flags;
+} modes[] = {
+    { "default", 0 },
+    { "lazy", LDCACHE_LAZY },
+    { "index", LDCACHE_INDEX },
+};
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            failures++; \
+        } \
+    } while (0)
+
+
+#define FLAGS_LIBC6_X8664 0x0303
+
+/* What writeCacheAs() puts in the extension_offset field. */
+enum extension_offset {
+    EXT_NONE,            /* 0, with no extension section. */
+    EXT_VALID,           /* The file offset of the extension section. */
+    EXT_MISALIGNED,      /* That plus 2. */
+    EXT_PAST_END,        /* The length of the file. */
+    EXT_HEADER_RELATIVE, /* The offset from the new header. */
+};
+
+/* Write a cache holding 'keys' in the order given and return its
+ * path. Entries map to 'values' if it is not NULL, and to "/lib/<key>"
+ * otherwise, with the key pointing into the tail of the path as
+ * ldconfig does. They carry 'flags' if it is not NULL, and are libc6
+ * x86-64 ones otherwise. With 'compat', the new format is embedded in
+ * the old one, as ldconfig did before glibc 2.32. Unless 'ext' is
+ * EXT_NONE, an extension section follows the strings, as ldconfig
+ * writes since glibc 2.33. */
+char *writeCacheAs(const char *const *keys, const char *const *values,
+                   const int32_t *flags, size_t n, bool compat,
+                   enum extension_offset ext)
+{
+    char *path = strdup("/tmp/ldcache_test.XXXXXX");
+    int fd = path != NULL ? mkstemp(path) : -1;
+    if (fd < 0) {
+        err(EXIT_FAILURE, "mkstemp() failed");
+    }
+
+    size_t oldstrtab = 0; /* Offset 0 for libentry_old indices. */
+    size_t newstart = 0;
+    if (compat) {
+        oldstrtab = sizeof(struct header_old) +
+                    n * sizeof(struct libentry_old);
+        newstart = (oldstrtab + __alignof__(struct header_new) - 1) &
+                   ~(__alignof__(struct header_new) - 1);
+    }
+
+    size_t strstart = newstart + sizeof(struct header_new) +
+                      n * sizeof(struct libentry_new);
+    size_t stringslen = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (values != NULL) {
+            stringslen += strlen(values[i]) + 1;
+        } else {
+            stringslen += strlen("/lib/");
+        }
+        stringslen += strlen(keys[i]) + 1;
+    }
+
+    size_t len = strstart + stringslen;
+    size_t extstart = (len + 3) & ~(size_t)3;
+    if (ext != EXT_NONE) {
+        len = extstart + sizeof(struct extension) + strlen(GENERATOR);
+    }
+
+    unsigned char *buf = calloc(1, len);
+    if (buf == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
+    }
+
+    if (compat) {
+        struct header_old hdr = { .nlibs = n };
+        memcpy(hdr.magic, CACHEMAGIC_OLD, sizeof(hdr.magic));
+        memcpy(buf, &hdr, sizeof(hdr));
+    }
+
+    struct header_new hdr = {
+        .nlibs = n,
+        .stringslen = stringslen,
+        .flags = CACHE_FLAGS_ENDIAN_HOST,
+    };
+    memcpy(hdr.magic, CACHEMAGIC_NEW, sizeof(hdr.magic));
+    switch (ext) {
+        case EXT_NONE:
+            break;
+        case EXT_VALID:
+            hdr.extension_offset = extstart;
+            break;
+        case EXT_MISALIGNED:
+            hdr.extension_offset = extstart + 2;
+            break;
+        case EXT_PAST_END:
+            hdr.extension_offset = len;
+            break;
+        case EXT_HEADER_RELATIVE:
+            hdr.extension_offset = extstart - newstart;
+            break;
+    }
+    memcpy(buf + newstart, &hdr, sizeof(hdr));
+
+    size_t off = strstart;
+    for (size_t i = 0; i < n; i++) {
+        int32_t f = flags != NULL ? flags[i] : FLAGS_LIBC6_X8664;
+        size_t valueoff = off;
+        size_t keyoff;
+        if (values != NULL) {
+            off += sprintf((char *)buf + off, "%s", values[i]) + 1;
+            keyoff = off;
+            off += sprintf((char *)buf + off, "%s", keys[i]) + 1;
+        } else {
+            keyoff = off + strlen("/lib/");
+            off += sprintf((char *)buf + off, "/lib/%s", keys[i]) + 1;
+        }
+
+        struct libentry_new lib = {
+            .flags = f,
+            .key = keyoff - newstart,
+            .value = valueoff - newstart,
+        };
+        memcpy(buf + newstart + sizeof(hdr) + i * sizeof(lib), &lib,
+               sizeof(lib));
+
+        if (compat) {
+            struct libentry_old old = {
+                .flags = f,
+                .key = keyoff - oldstrtab,
+                .value = valueoff - oldstrtab,
+            };
+            memcpy(buf + sizeof(struct header_old) + i * sizeof(old), &old,
+                   sizeof(old));
+        }
+    }
+
+    if (ext != EXT_NONE) {
+        struct extension e = {
+            .magic = EXTENSIONMAGIC,
+            .count = 1,
+            .tag = 0, /* cache_extension_tag_generator */
+            .offset = extstart + sizeof(e),
+            .size = strlen(GENERATOR),
+        };
+        memcpy(buf + extstart, &e, sizeof(e));
+        memcpy(buf + extstart + sizeof(e), GENERATOR, strlen(GENERATOR));
+    }
+
+    if (write(fd, buf, len) != (ssize_t)len || close(fd) == -1) {
+        err(EXIT_FAILURE, "write '%s' failed", path);
+    }
+    free(buf);
+    return path;
+}
+
+
+/* Write a new format only cache, with no extension section. */
+char *writeCache(const char *const *keys, const int32_t *flags, size_t n)
+{
+    return writeCacheAs(keys, NULL, flags, n, false, EXT_NONE);
+}
+
+
+/* Check that each of 'keys' is found exactly once in the cache at
+ * 'path', at the index it was written at, and that 'missing' is not
+ * found, whichever way the cache is opened. */
+void checkLookups(const char *what, const char *path,
+                  const char *const *keys, size_t n, const char *missing)
+{
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        struct ldcache *cache;
+        int ret = ldcache_open(&cache, path, modes[m].flags);
+        CHECK(ret == LDCACHE_SUCCESS, "%s/%s: open: %s", what,
+              modes[m].name, ldcache_strerror(ret));
+        if (ret != LDCACHE_SUCCESS) {
+            continue;
+        }
+
+        /* A miss first, so that a lazily opened cache has not learned
+         * anything about its order from earlier hits. */
+        size_t nfound;
+        ret = ldcache_lookup(cache, missing, NULL, 0, &nfound);
+        CHECK(ret == LDCACHE_ERROR_NOTFOUND, "%s/%s: lookup '%s': %s",
+              what, modes[m].name, missing, ldcache_strerror(ret));
+
+        for (size_t i = 0; i < n; i++) {
+            struct ldcache_entry entry;
+            ret = ldcache_lookup(cache, keys[i], &entry, 1, &nfound);
+            CHECK(ret == LDCACHE_SUCCESS, "%s/%s: lookup '%s': %s",
+                  what, modes[m].name, keys[i], ldcache_strerror(ret));
+            if (ret == LDCACHE_SUCCESS) {
+                CHECK(nfound == 1 && entry.index == i,
+                      "%s/%s: lookup '%s': %zu matches, first at %u",
+                      what, modes[m].name, keys[i], nfound, entry.index);
+            }
+        }
+        ldcache_close(cache);
+    }
+}
+
+
+void testCache(const char *what, const char *const *keys, size_t n,
+               const char *missing)
+{
+    char *path = writeCache(keys, NULL, n);
+    checkLookups(what, path, keys, n, missing);
+    unlink(path);
+    free(path);
+}
+
+
+/* Check that each architecture's view holds exactly the entries with
+ * that architecture, in cache order, whether the views are built at
+ * open time or on first use. */
+void testArchViews(void)
+{
+    static const char *const keys[] = {
+        "libz.so.1", "libz.so.1", "libm.so.6", "libm.so.6", "libc.so.6",
+        "libc.so.6",
+    };
+    static const int32_t flags[] = {
+        0x0303, /* libc6,x86-64 */
+        0x0003, /* libc6 (i386) */
+        0x0a03, /* libc6,AArch64 */
+        0x0303,
+        0x7f03, /* libc6 with an architecture byte ldconfig never uses */
+        0x0003,
+    };
+    static const struct {
+        enum ldcache_arch arch;
+        size_t count;
+        uint32_t indices[2];
+    } views[] = {
+        { LDCACHE_ARCH_X8664_LIB64, 2, { 0, 3 } },
+        { LDCACHE_ARCH_NONE, 2, { 1, 5 } },
+        { LDCACHE_ARCH_AARCH64_LIB64, 1, { 2 } },
+        { LDCACHE_ARCH_UNKNOWN, 1, { 4 } },
+        { LDCACHE_ARCH_ARM_LIBHF, 0, { 0 } },
+    };
+    static const int modeflags[] = { 0, LDCACHE_ARCH_VIEWS };
+
+    char *path = writeCache(keys, flags, 6);
+
+    for (size_t m = 0; m < 2; m++) {
+        struct ldcache *cache;
+        int ret = ldcache_open(&cache, path, modeflags[m]);
+        CHECK(ret == LDCACHE_SUCCESS, "arch views: open: %s",
+              ldcache_strerror(ret));
+        if (ret != LDCACHE_SUCCESS) {
+            continue;
+        }
+
+        for (size_t v = 0; v < sizeof(views) / sizeof(views[0]); v++) {
+            const uint32_t *indices;
+            size_t count;
+            ret = ldcache_arch_view(cache, views[v].arch, &indices, &count);
+            CHECK(ret == LDCACHE_SUCCESS && count == views[v].count &&
+                  memcmp(indices, views[v].indices,
+                         count * sizeof(uint32_t)) == 0,
+                  "arch views: view of '%s' (flags %#x)",
+                  ldcache_arch_name(views[v].arch), modeflags[m]);
+        }
+
+        const uint32_t *indices;
+        size_t count;
+        ret = ldcache_arch_view(cache, LDCACHE_NARCH, &indices, &count);
+        CHECK(ret == LDCACHE_ERROR_INVAL, "arch views: out of range arch: %s",
+              ldcache_strerror(ret));
+        ldcache_close(cache);
+    }
+
+    unlink(path);
+    free(path);
+
+    char buf[32];
+    ldcache_flags_str(0x0303, buf, sizeof(buf));
+    CHECK(strcmp(buf, "libc6,x86-64") == 0, "flags_str 0x0303: '%s'", buf);
+    ldcache_flags_str(0x0003, buf, sizeof(buf));
+    CHECK(strcmp(buf, "libc6") == 0, "flags_str 0x0003: '%s'", buf);
+    ldcache_flags_str(0x7f03, buf, sizeof(buf));
+    CHECK(strcmp(buf, "libc6,32512") == 0, "flags_str 0x7f03: '%s'", buf);
+
+    enum ldcache_arch arch;
+    CHECK(ldcache_arch_parse("aarch64", &arch) == LDCACHE_SUCCESS &&
+          arch == LDCACHE_ARCH_AARCH64_LIB64, "arch_parse 'aarch64'");
+    CHECK(ldcache_arch_parse("vax", &arch) == LDCACHE_ERROR_NOTFOUND,
+          "arch_parse 'vax'");
+}
+
+
+/* Check that ldcache_search() finds exactly the entries whose keys
+ * fnmatch() each pattern, in cache order. */
+void testSearch(void)
+{
+    static const char *const keys[] = {
+        "libz.so.1", "libnvidia-ml.so.1", "libnvidia-glcore.so.550",
+        "libm.so.6", "libglib-2.0.so.0", "libc.so.6", "libc.so.6",
+        "ld-linux-x86-64.so.2", "liba[1].so",
+    };
+    static const char *const patterns[] = {
+        "libnvidia-*.so.*",  /* Unanchored literal, several hits. */
+        "libc.so.6",         /* No wildcards at all. */
+        "lib?.so.6",
+        "*",                 /* No literal to search for. */
+        "*.so.[0-2]",
+        "*-x86-64*",
+        "liba\\[1\\].so",    /* Escaped brackets. */
+        "liba[1].so",        /* A bracket expression matching "liba1.so". */
+        "libnothere*",
+    };
+    size_t n = sizeof(keys) / sizeof(keys[0]);
+
+    char *path = writeCache(keys, NULL, n);
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        struct ldcache *cache;
+        int ret = ldcache_open(&cache, path, modes[m].flags);
+        CHECK(ret == LDCACHE_SUCCESS, "search/%s: open: %s", modes[m].name,
+              ldcache_strerror(ret));
+        if (ret != LDCACHE_SUCCESS) {
+            continue;
+        }
+
+        for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+            struct ldcache_entry found[16];
+            size_t nfound;
+            ret = ldcache_search(cache, patterns[p], found, 16, &nfound);
+
+            size_t want = 0;
+            bool same = true;
+            for (size_t i = 0; i < n; i++) {
+                if (fnmatch(patterns[p], keys[i], 0) != 0) {
+                    continue;
+                }
+                same = same && want < nfound && found[want].index == i;
+                want++;
+            }
+
+            CHECK(ret == (want > 0 ? LDCACHE_SUCCESS : LDCACHE_ERROR_NOTFOUND),
+                  "search/%s: '%s': %s", modes[m].name, patterns[p],
+                  ldcache_strerror(ret));
+            CHECK(nfound == want && same,
+                  "search/%s: '%s': %zu matches, expected %zu",
+                  modes[m].name, patterns[p], nfound, want);
+        }
+        ldcache_close(cache);
+    }
+
+    unlink(path);
+    free(path);
+}
+
+
+/* Check whether 'soname' is found in 'cache', once. */
+static bool found(struct ldcache *cache, const char *soname)
+{
+    size_t nfound;
+    return ldcache_lookup(cache, soname, NULL, 0, &nfound) ==
+           LDCACHE_SUCCESS && nfound == 1;
+}
+
+
+/* Check that ldcache_refresh() only reloads a replaced cache, and
+ * that a failed reload keeps the old snapshot usable. */
+void testRefresh(void)
+{
+    static const char *const before[] = { "libold.so.1" };
+    static const char *const after[] = { "libnew.so.1" };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        char *path = writeCache(before, NULL, 1);
+
+        struct ldcache *cache;
+        int ret = ldcache_open(&cache, path, modes[m].flags);
+        CHECK(ret == LDCACHE_SUCCESS, "refresh/%s: open: %s",
+              modes[m].name, ldcache_strerror(ret));
+        if (ret != LDCACHE_SUCCESS) {
+            unlink(path);
+            free(path);
+            continue;
+        }
+
+        int changed = -1;
+        ret = ldcache_refresh(cache, &changed);
+        CHECK(ret == LDCACHE_SUCCESS && changed == 0,
+              "refresh/%s: unchanged cache: %s, changed %d",
+              modes[m].name, ldcache_strerror(ret), changed);
+
+        /* Replaced by rename(), as ldconfig does. */
+        char *fresh = writeCache(after, NULL, 1);
+        if (rename(fresh, path) == -1) {
+            err(EXIT_FAILURE, "rename '%s' failed", fresh);
+        }
+        free(fresh);
+
+        ret = ldcache_refresh(cache, &changed);
+        CHECK(ret == LDCACHE_SUCCESS && changed == 1,
+              "refresh/%s: replaced cache: %s, changed %d",
+              modes[m].name, ldcache_strerror(ret), changed);
+        CHECK(found(cache, "libnew.so.1") && !found(cache, "libold.so.1"),
+              "refresh/%s: lookups after reload", modes[m].name);
+
+        /* A malformed replacement is refused, and the handle keeps
+         * answering from what it had. */
+        fresh = writeCache(after, NULL, 1);
+        if (truncate(fresh, 16) == -1 || rename(fresh, path) == -1) {
+            err(EXIT_FAILURE, "truncating '%s' failed", fresh);
+        }
+        free(fresh);
+
+        ret = ldcache_refresh(cache, &changed);
+        CHECK(ret == LDCACHE_ERROR_FORMAT && changed == 0,
+              "refresh/%s: malformed cache: %s, changed %d",
+              modes[m].name, ldcache_strerror(ret), changed);
+        CHECK(found(cache, "libnew.so.1"),
+              "refresh/%s: lookups after failed reload", modes[m].name);
+
+        unlink(path);
+        ret = ldcache_refresh(cache, &changed);
+        CHECK(ret == LDCACHE_ERROR_OPEN && changed == 0,
+              "refresh/%s: removed cache: %s, changed %d",
+              modes[m].name, ldcache_strerror(ret), changed);
+
+        ldcache_close(cache);
+        free(path);
+    }
+}
+
+
+/* Check that compat and new format only caches parse the same, with
+ * or without an extension section, and that an extension section
+ * must be where glibc's loader would look for it. */
+void testFormats(void)
+{
+    static const char *const keys[] = {
+        "libz.so.1", "libm.so.6", "libc.so.6",
+    };
+    static const struct {
+        const char *name;
+        bool compat;
+        enum extension_offset ext;
+        int ret;
+    } layouts[] = {
+        { "new", false, EXT_NONE, LDCACHE_SUCCESS },
+        { "compat", true, EXT_NONE, LDCACHE_SUCCESS },
+        { "new+ext", false, EXT_VALID, LDCACHE_SUCCESS },
+        { "compat+ext", true, EXT_VALID, LDCACHE_SUCCESS },
+        { "compat+misaligned ext", true, EXT_MISALIGNED,
+          LDCACHE_ERROR_FORMAT },
+        { "compat+ext past end", true, EXT_PAST_END, LDCACHE_ERROR_FORMAT },
+        { "compat+header relative ext", true, EXT_HEADER_RELATIVE,
+          LDCACHE_ERROR_FORMAT },
+    };
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        char *path = writeCacheAs(keys, NULL, NULL, 3, layouts[l].compat,
+                                  layouts[l].ext);
+
+        struct ldcache *cache;
+        int ret = ldcache_open(&cache, path, 0);
+        CHECK(ret == layouts[l].ret, "%s: open: %s", layouts[l].name,
+              ldcache_strerror(ret));
+
+        if (ret == LDCACHE_SUCCESS) {
+            struct ldcache_info info;
+            ldcache_info(cache, &info);
+            CHECK(info.format == (layouts[l].compat ? LDCACHE_FORMAT_COMPAT
+                                                    : LDCACHE_FORMAT_NEW) &&
+                  info.new_nlibs == 3 &&
+                  info.old_nlibs == (layouts[l].compat ? 3 : 0) &&
+                  strcmp(info.new_magic, CACHEMAGIC_NEW) == 0 &&
+                  strcmp(info.old_magic,
+                         layouts[l].compat ? CACHEMAGIC_OLD : "") == 0,
+                  "%s: info", layouts[l].name);
+            ldcache_close(cache);
+
+            checkLookups(layouts[l].name, path, keys, 3, "libx.so.1");
+        }
+
+        unlink(path);
+        free(path);
+    }
+}
+
+
+/* Check that an index file is only used with the cache it was built
+ * from, and that a stale one is rebuilt on request. */
+void testIndexFile(void)
+{
+    static const char *const before[] = { "libold.so.1", "libc.so.6" };
+    static const char *const after[] = { "libnew.so.1", "libc.so.6" };
+
+    char *path = writeCache(before, NULL, 2);
+    char *index;
+    if (asprintf(&index, "%s.index", path) < 0) {
+        err(EXIT_FAILURE, "asprintf() failed");
+    }
+
+    struct ldcache *cache;
+    int ret = ldcache_open(&cache, path, 0);
+    if (ret != LDCACHE_SUCCESS) {
+        errx(EXIT_FAILURE, "index file: open: %s", ldcache_strerror(ret));
+    }
+
+    ret = ldcache_index_file(cache, index, 0);
+    CHECK(ret == LDCACHE_ERROR_OPEN, "index file: missing: %s",
+          ldcache_strerror(ret));
+    ret = ldcache_index_file(cache, index, LDCACHE_INDEX_REBUILD);
+    CHECK(ret == LDCACHE_SUCCESS, "index file: build: %s",
+          ldcache_strerror(ret));
+    CHECK(found(cache, "libold.so.1") && !found(cache, "libnew.so.1"),
+          "index file: lookups after build");
+    ldcache_close(cache);
+
+    /* A second handle on the same cache maps the file as it is. */
+    struct stat st;
+    stat(index, &st);
+    ret = ldcache_open(&cache, path, 0);
+    CHECK(ret == LDCACHE_SUCCESS, "index file: reopen: %s",
+          ldcache_strerror(ret));
+    ret = ldcache_index_file(cache, index, LDCACHE_INDEX_REBUILD);
+    CHECK(ret == LDCACHE_SUCCESS, "index file: reuse: %s",
+          ldcache_strerror(ret));
+    struct stat st2;
+    stat(index, &st2);
+    CHECK(st.st_ino == st2.st_ino, "index file: rebuilt when current");
+    CHECK(found(cache, "libold.so.1") && found(cache, "libc.so.6") &&
+          !found(cache, "libnew.so.1"), "index file: lookups when mapped");
+
+    /* Replace the cache. The handle above keeps its snapshot and the
+     * index that matches it, and a refresh reapplies the index file,
+     * rebuilding it since it is now stale. */
+    char *fresh = writeCache(after, NULL, 2);
+    if (rename(fresh, path) == -1) {
+        err(EXIT_FAILURE, "rename '%s' failed", fresh);
+    }
+    free(fresh);
+
+    struct ldcache *other;
+    ret = ldcache_open(&other, path, 0);
+    CHECK(ret == LDCACHE_SUCCESS, "index file: open replaced: %s",
+          ldcache_strerror(ret));
+    if (ret == LDCACHE_SUCCESS) {
+        ret = ldcache_index_file(other, index, 0);
+        CHECK(ret == LDCACHE_ERROR_FORMAT, "index file: stale: %s",
+              ldcache_strerror(ret));
+        CHECK(found(other, "libnew.so.1") && !found(other, "libold.so.1"),
+              "index file: lookups with a stale index refused");
+        ldcache_close(other);
+    }
+
+    int changed;
+    ret = ldcache_refresh(cache, &changed);
+    CHECK(ret == LDCACHE_SUCCESS && changed == 1, "index file: refresh: %s",
+          ldcache_strerror(ret));
+    CHECK(found(cache, "libnew.so.1") && !found(cache, "libold.so.1"),
+          "index file: lookups after refresh");
+    stat(index, &st2);
+    CHECK(st.st_ino != st2.st_ino, "index file: not rebuilt on refresh");
+    ldcache_close(cache);
+
+    ret = ldcache_open(&other, path, 0);
+    CHECK(ret == LDCACHE_SUCCESS, "index file: open replaced: %s",
+          ldcache_strerror(ret));
+    if (ret == LDCACHE_SUCCESS) {
+        ret = ldcache_index_file(other, index, 0);
+        CHECK(ret == LDCACHE_SUCCESS, "index file: rebuilt: %s",
+              ldcache_strerror(ret));
+
+        /* Touching the cache in place also makes the index stale. */
+        struct timespec times[2] = { { 0, UTIME_OMIT }, { 1, 0 } };
+        if (utimensat(AT_FDCWD, path, times, 0) == -1) {
+            err(EXIT_FAILURE, "utimensat '%s' failed", path);
+        }
+        ldcache_close(other);
+        ret = ldcache_open(&other, path, 0);
+        CHECK(ret == LDCACHE_SUCCESS, "index file: open touched: %s",
+              ldcache_strerror(ret));
+        ret = ldcache_index_file(other, index, 0);
+        CHECK(ret == LDCACHE_ERROR_FORMAT, "index file: touched cache: %s",
+              ldcache_strerror(ret));
+
+        /* As does any damage to the index file itself. */
+        ret = ldcache_index_file(other, index, LDCACHE_INDEX_REBUILD);
+        CHECK(ret == LDCACHE_SUCCESS, "index file: rebuild: %s",
+              ldcache_strerror(ret));
+        if (stat(index, &st) == -1 || truncate(index, st.st_size - 1) == -1) {
+            err(EXIT_FAILURE, "truncating '%s' failed", index);
+        }
+        ret = ldcache_index_file(other, index, 0);
+        CHECK(ret == LDCACHE_ERROR_FORMAT, "index file: truncated: %s",
+              ldcache_strerror(ret));
+        ldcache_close(other);
+    }
+
+    unlink(index);
+    unlink(path);
+    free(index);
+    free(path);
+}
+
+
+/* Run the ldcache tool built next to the test with 'args', returning
+ * its exit status and its output in 'out'. */
+static int runLdcache(const char *args, char *out, size_t len)
+{
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "./ldcache %s", args);
+
+    FILE *f = popen(cmd, "r");
+    if (f == NULL) {
+        err(EXIT_FAILURE, "popen '%s' failed", cmd);
+    }
+    size_t n = fread(out, 1, len - 1, f);
+    out[n] = '\0';
+
+    int status = pclose(f);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+/* Check 'ldcache -d': entries are matched on soname, flags and hwcap
+ * regardless of their position, and reported as removed, added, or
+ * changed if their path differs. */
+void testDiff(void)
+{
+    static const char *const oldkeys[] = {
+        "libz.so.1", "libm.so.6", "libm.so.6", "libc.so.6",
+    };
+    static const char *const oldvalues[] = {
+        "/lib/libz.so.1", "/lib/libm.so.6", "/lib32/libm.so.6",
+        "/lib/libc.so.6",
+    };
+    static const int32_t oldflags[] = { 0x0303, 0x0303, 0x0003, 0x0303 };
+
+    /* Reordered, with the i386 libm removed, libc moved and libnew
+     * added. */
+    static const char *const newkeys[] = {
+        "libz.so.1", "libnew.so.1", "libm.so.6", "libc.so.6",
+    };
+    static const char *const newvalues[] = {
+        "/lib/libz.so.1", "/lib/libnew.so.1", "/lib/libm.so.6",
+        "/usr/lib/libc.so.6",
+    };
+    static const int32_t newflags[] = { 0x0303, 0x0303, 0x0303, 0x0303 };
+
+    char *oldpath = writeCacheAs(oldkeys, oldvalues, oldflags, 4, false,
+                                 EXT_NONE);
+    char *newpath = writeCacheAs(newkeys, newvalues, newflags, 4, true,
+                                 EXT_NONE);
+    char args[256];
+    char out[4096];
+
+    snprintf(args, sizeof(args), "-d -o tsv %s %s", oldpath, newpath);
+    int status = runLdcache(args, out, sizeof(out));
+    CHECK(status == 1, "diff: exit status %d", status);
+    CHECK(strcmp(out,
+                 "changed\tlibc.so.6\t0x0303\tlibc6,x86-64\t"
+                 "0x0000000000000000\t/lib/libc.so.6\t/usr/lib/libc.so.6\t"
+                 "0\t0\n"
+                 "removed\tlibm.so.6\t0x0003\tlibc6\t0x0000000000000000\t"
+                 "/lib32/libm.so.6\t\t0\t\n"
+                 "added\tlibnew.so.1\t0x0303\tlibc6,x86-64\t"
+                 "0x0000000000000000\t\t/lib/libnew.so.1\t\t0\n") == 0,
+          "diff: got:\n%s", out);
+
+    snprintf(args, sizeof(args), "-d -a none %s %s", oldpath, newpath);
+    status = runLdcache(args, out, sizeof(out));
+    CHECK(status == 1, "diff -a none: exit status %d", status);
+    CHECK(strcmp(out, "- libm.so.6 (libc6) => /lib32/libm.so.6\n") == 0,
+          "diff -a none: got:\n%s", out);
+
+    snprintf(args, sizeof(args), "-d %s %s", newpath, newpath);
+    status = runLdcache(args, out, sizeof(out));
+    CHECK(status == 0 && out[0] == '\0', "diff with itself: exit status %d, "
+          "got:\n%s", status, out);
+
+    snprintf(args, sizeof(args), "-d %s %s.missing 2>/dev/null", oldpath,
+             oldpath);
+    status = runLdcache(args, out, sizeof(out));
+    CHECK(status == 2, "diff with a missing cache: exit status %d", status);
+
+    unlink(oldpath);
+    unlink(newpath);
+    free(oldpath);
+    free(newpath);
+}
+
+
+int main(void)
+{
+    /* ldconfig's order: descending, with version numbers compared
+     * numerically. */
+    static const char *const sorted[] = {
+        "libz.so.1", "libm.so.6", "libc.so.10", "libc.so.6", "liba.so.1",
+    };
+    testCache("sorted", sorted, 5, "libb.so.1");
+
+    /* Out of order away from the path a binary search takes, so that
+     * only a check of the whole order notices. */
+    static const char *const unsorted[] = {
+        "liba.so.1", "libc.so.1", "libb.so.1",
+    };
+    testCache("unsorted", unsorted, 3, "liba.so.0");
+
+    static const char *const single[] = { "libc.so.6" };
+    testCache("single", single, 1, "libm.so.6");
+
+    testFormats();
+    testArchViews();
+    testSearch();
+    testRefresh();
+    testIndexFile();
+    testDiff();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ldcache.h"
+#include "outbuf.h"
+
+#define LDCACHED_SOCKET "/run/ldcached.sock"
+
+#define MAX_CLIENTS 64
+#define MAX_REQUEST 512
+
+/* ldcached keeps a parsed and indexed copy of the cache resident, and
+ * answers soname lookups from it over a UNIX stream socket. Clients
+ * send one soname per line. For each request the daemon replies with
+ * one line per matching entry:
+
+        <soname> TAB <flags> TAB <hwcap> TAB <path>
+
+ * where <flags> is formatted as 'ldconfig -p' prints it and <hwcap> is
+ * in hex, followed by an empty line. A soname with no matches gets
+ * just the empty line. If the lookup fails, e.g. on a malformed entry,
+ * the reply is instead a single line
+
+        ! TAB <error message>
+
+ * followed by the empty line, so that it can't be mistaken for a miss.
+ *
+ * ldconfig never rewrites the cache in place. It writes a temporary
+ * file and rename()s it over the old one, so the daemon watches the
+ * directory holding the cache with inotify, and reloads whenever a
+ * file is moved to (or written in place at) the cache path. Events
+ * that leave the file unchanged are filtered out by ldcache_refresh(),
+ * and lookups keep being served from the old copy until the new one
+ * has been parsed successfully.
+ *
+ * Client sockets are non-blocking. Replies are queued in a per-client
+ * buffer and sent as the socket takes them, and a client's requests
+ * are not read while it has replies pending, so a client that sends
+ * requests without reading the replies only ever holds up itself. */
+
+struct client
+{
+  int fd;
+  size_t len;
+  char buf[MAX_REQUEST];
+
+  /* Replies not sent yet, from out.buf + sent on. */
+  struct outbuf out;
+  size_t sent;
+};
+
+static volatile sig_atomic_t done;
+
+static void handleSignal(int sig)
+{
+    (void)sig;
+    done = 1;
+}
+
+
+int watchCache(const char *path, const char **name)
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "inotify_init1() failed");
+    }
+
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+        *name = path;
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s",
+                 (int)(slash == path ? 1 : slash - path), path);
+        *name = slash + 1;
+    }
+
+    if (inotify_add_watch(fd, dir, IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        err(EXIT_FAILURE, "inotify_add_watch '%s' failed", dir);
+    }
+    return fd;
+}
+
+
+/* Drain pending inotify events and report whether any of them
+ * replaced or rewrote the file called 'name'. If the event queue
+ * overflowed, the events for 'name' may be among those dropped, so
+ * that counts as a change too; ldcache_refresh() finds out cheaply if
+ * there really was one. */
+bool cacheChanged(int fd, const char *name)
+{
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+
+        for (char *p = buf; p < buf + len;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if ((ev->mask & IN_Q_OVERFLOW) ||
+                (ev->len > 0 && strcmp(ev->name, name) == 0)) {
+                changed = true;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return changed;
+}
+
+
+void reloadCache(struct ldcache *cache, const char *path)
+{
+    int ret = ldcache_refresh(cache, NULL);
+    if (ret != LDCACHE_SUCCESS) {
+        warnx("reloading '%s' failed: %s; keeping previous copy",
+              path, ldcache_strerror(ret));
+    }
+}
+
+
+int listenSocket(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errx(EXIT_FAILURE, "socket path '%s' too long", path);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "socket() failed");
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        err(EXIT_FAILURE, "bind '%s' failed", path);
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        err(EXIT_FAILURE, "listen() failed");
+    }
+    return fd;
+}
+
+
+/* Send as much of the pending replies as the socket takes. Returns
+ * false once the client should be disconnected. */
+bool flushClient(struct client *c)
+{
+    if (c->out.error != 0) {
+        return false;
+    }
+
+    while (c->sent < c->out.len) {
+        ssize_t n = send(c->fd, c->out.buf + c->sent, c->out.len - c->sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->sent += n;
+    }
+
+    c->out.len = 0;
+    c->sent = 0;
+    return true;
+}
+
+
+/* Queue the reply to one request line. Every match is included, in
+ * cache order. */
+void answer(struct ldcache *cache, struct client *c, const char *soname)
+{
+    struct ldcache_entry local[16];
+    struct ldcache_entry *entries = local;
+    size_t nfound = 0;
+
+    int ret = ldcache_lookup(cache, soname, entries, 16, &nfound);
+    if (ret == LDCACHE_SUCCESS && nfound > 16) {
+        /* Rare, so the first call is sized for the common case and
+         * only its count is used here. */
+        entries = malloc(nfound * sizeof(*entries));
+        if (entries == NULL) {
+            ret = LDCACHE_ERROR_NOMEM;
+        } else {
+            ret = ldcache_lookup(cache, soname, entries, nfound, &nfound);
+        }
+    }
+
+    if (ret == LDCACHE_ERROR_NOTFOUND) {
+        nfound = 0;
+    } else if (ret != LDCACHE_SUCCESS) {
+        outbuf_str(&c->out, "!\t");
+        outbuf_str(&c->out, ldcache_strerror(ret));
+        outbuf_char(&c->out, '\n');
+        nfound = 0;
+    }
+
+    for (size_t i = 0; i < nfound; i++) {
+        char flags[64];
+        ldcache_flags_str(entries[i].flags, flags, sizeof(flags));
+
+        outbuf_str(&c->out, entries[i].key);
+        outbuf_char(&c->out, '\t');
+        outbuf_str(&c->out, flags);
+        outbuf_char(&c->out, '\t');
+        if (entries[i].hwcap != 0) {
+            outbuf_write(&c->out, "0x", 2);
+        }
+        outbuf_hex(&c->out, entries[i].hwcap, 1);
+        outbuf_char(&c->out, '\t');
+        outbuf_str(&c->out, entries[i].value);
+        outbuf_char(&c->out, '\n');
+    }
+    outbuf_char(&c->out, '\n');
+
+    if (entries != local) {
+        free(entries);
+    }
+}
+
+
+/* Read whatever the client sent, queue the answer to each complete
+ * line and start sending them. Returns false once the client should
+ * be disconnected. */
+bool serveClient(struct ldcache *cache, struct client *c)
+{
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+    if (n <= 0) {
+        return n < 0 && (errno == EINTR || errno == EAGAIN ||
+                         errno == EWOULDBLOCK);
+    }
+    c->len += n;
+
+    char *start = c->buf;
+    char *nl;
+    while ((nl = memchr(start, '\n', c->buf + c->len - start)) != NULL) {
+        *nl = '\0';
+        answer(cache, c, start);
+        start = nl + 1;
+    }
+
+    /* A request that doesn't fit in the buffer is never valid. */
+    c->len -= start - c->buf;
+    if (c->len == sizeof(c->buf)) {
+        return false;
+    }
+    memmove(c->buf, start, c->len);
+    return flushClient(c);
+}
+
+
+void dropClient(struct client *c)
+{
+    close(c->fd);
+    outbuf_free(&c->out);
+    free(c);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *path = LDCACHE_DEFAULT_PATH;
+    const char *sockpath = LDCACHED_SOCKET;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:s:")) != -1) {
+        switch (opt) {
+            case 'f':
+                path = optarg;
+                break;
+            case 's':
+                sockpath = optarg;
+                break;
+            default:
+                errx(EXIT_FAILURE, "usage: %s [-f cache] [-s socket]",
+                    argv[0]);
+        }
+    }
+
+    struct sigaction sa = { .sa_handler = handleSignal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Start watching before the first load, so that a cache replaced
+     * in between is not missed. */
+    const char *name;
+    int ifd = watchCache(path, &name);
+
+    struct ldcache *cache;
+    int ret = ldcache_open(&cache, path, LDCACHE_INDEX);
+    if (ret == LDCACHE_ERROR_OPEN || ret == LDCACHE_ERROR_MMAP) {
+        err(EXIT_FAILURE, "error loading '%s'", path);
+    }
+    if (ret != LDCACHE_SUCCESS) {
+        errx(EXIT_FAILURE, "error parsing '%s': %s",
+            path, ldcache_strerror(ret));
+    }
+
+    int lfd = listenSocket(sockpath);
+
+    /* pfds[0] is the inotify fd, pfds[1] the listening socket, and the
+     * rest correspond to clients[]. */
+    struct pollfd pfds[2 + MAX_CLIENTS];
+    struct client *clients[MAX_CLIENTS];
+    int nclients = 0;
+
+    while (!done) {
+        pfds[0] = (struct pollfd){ .fd = ifd, .events = POLLIN };
+        pfds[1] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+        for (int i = 0; i < nclients; i++) {
+            bool pending = clients[i]->sent < clients[i]->out.len;
+            pfds[2 + i] = (struct pollfd){ .fd = clients[i]->fd,
+                                           .events = pending ? POLLOUT
+                                                             : POLLIN };
+        }
+
+        if (poll(pfds, 2 + nclients, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err(EXIT_FAILURE, "poll() failed");
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            if (cacheChanged(ifd, name)) {
+                reloadCache(cache, path);
+            }
+        }
+
+        /* Serve existing clients before accepting new ones, so that
+         * clients[] still lines up with pfds[]. */
+        for (int i = nclients - 1; i >= 0; i--) {
+            short revents = pfds[2 + i].revents;
+            bool ok = true;
+            if (pfds[2 + i].events & POLLOUT) {
+                if (revents & (POLLOUT | POLLHUP | POLLERR)) {
+                    ok = flushClient(clients[i]);
+                }
+            } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                ok = serveClient(cache, clients[i]);
+            }
+            if (!ok) {
+                dropClient(clients[i]);
+                clients[i] = clients[--nclients];
+            }
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+
+            struct client *c = NULL;
+            if (nclients < MAX_CLIENTS) {
+                c = calloc(1, sizeof(*c));
+            }
+            if (c != NULL && outbuf_init(&c->out, -1, 4096) == -1) {
+                free(c);
+                c = NULL;
+            }
+            if (c == NULL) {
+                close(fd);
+                continue;
+            }
+            c->fd = fd;
+            clients[nclients++] = c;
+        }
+    }
+
+    for (int i = 0; i < nclients; i++) {
+        dropClient(clients[i]);
+    }
+    close(lfd);
+    unlink(sockpath);
+    close(ifd);
+    ldcache_close(cache);
+    return 0;
+}
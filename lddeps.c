@@ -0,0 +1,463 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ldcache.h"
+#include "outbuf.h"
+#include "soinfo.h"
+
+/* lddeps lists the transitive DT_NEEDED closure of each file given,
+ * resolving every soname through ld.so.cache the way the dynamic
+ * linker would for a library without a run path: the first entry in
+ * cache order for the requesting object's architecture wins.
+ *
+ * The cache is parsed and indexed once, and every object is parsed at
+ * most once no matter how many files (or how many other objects) pull
+ * it in: parsed objects are kept in a table keyed by path, along with
+ * the resolution of each of their dependencies. */
+
+#define NOT_FOUND UINT32_MAX
+
+struct object
+{
+  char *path;
+  struct soinfo *info; /* NULL if the object failed to parse. */
+  int error;           /* Why parsing failed, */
+  int errnum;          /* and errno for SOINFO_ERROR_OPEN. */
+  uint32_t *deps;      /* Object for each of info->deps, or NOT_FOUND.
+                          NULL until the dependencies are resolved. */
+  uint32_t seen;       /* Last closure the object was listed in. */
+};
+
+struct resolver
+{
+  struct ldcache *cache;
+  struct object *objects;
+  uint32_t nobjects;
+  uint32_t capacity;
+
+  /* Open-addressing table over objects[], by path. Slots hold object
+   * indices plus one, so that 0 marks an empty slot. */
+  uint32_t *slots;
+  uint32_t nslots; /* Always a power of two. */
+};
+
+static uint32_t hashPath(const char *path)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static uint32_t *findSlot(const struct resolver *r, const char *path)
+{
+    uint32_t mask = r->nslots - 1;
+
+    for (uint32_t i = hashPath(path) & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &r->slots[i];
+        if (*slot == 0 || strcmp(r->objects[*slot - 1].path, path) == 0) {
+            return slot;
+        }
+    }
+}
+
+
+/* Double the table, keeping the load factor at most 1/2. */
+static void growTable(struct resolver *r)
+{
+    uint32_t nslots = r->nslots ? r->nslots * 2 : 64;
+    uint32_t *old = r->slots;
+    uint32_t oldslots = r->nslots;
+
+    r->slots = calloc(nslots, sizeof(*r->slots));
+    if (r->slots == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
+    }
+    r->nslots = nslots;
+
+    for (uint32_t i = 0; i < oldslots; i++) {
+        if (old[i] != 0) {
+            *findSlot(r, r->objects[old[i] - 1].path) = old[i];
+        }
+    }
+    free(old);
+}
+
+
+/* Return the object for 'path', parsing it the first time it is seen.
+ * Since objects[] may move, callers must not hold on to pointers into
+ * it across calls. */
+uint32_t internObject(struct resolver *r, const char *path)
+{
+    if (2 * (r->nobjects + 1) > r->nslots) {
+        growTable(r);
+    }
+
+    uint32_t *slot = findSlot(r, path);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    if (r->nobjects == r->capacity) {
+        r->capacity = r->capacity ? r->capacity * 2 : 64;
+        r->objects = realloc(r->objects,
+                             r->capacity * sizeof(*r->objects));
+        if (r->objects == NULL) {
+            err(EXIT_FAILURE, "realloc() failed");
+        }
+    }
+
+    struct object *obj = &r->objects[r->nobjects];
+    memset(obj, 0, sizeof(*obj));
+    obj->path = strdup(path);
+    if (obj->path == NULL) {
+        err(EXIT_FAILURE, "strdup() failed");
+    }
+    obj->error = soinfo_load(&obj->info, path, 0);
+    if (obj->error != SOINFO_SUCCESS) {
+        obj->errnum = errno;
+        obj->info = NULL;
+    }
+
+    *slot = ++r->nobjects;
+    return r->nobjects - 1;
+}
+
+
+/* Find the library the dynamic linker would load for 'soname' on
+ * behalf of an object of architecture 'arch'. Entries for hwcap
+ * subdirectories are only used if there is no plain entry. */
+const char *resolveSoname(struct resolver *r, const char *soname,
+                          enum ldcache_arch arch)
+{
+    if (strchr(soname, '/') != NULL) {
+        return soname;
+    }
+
+    struct ldcache_entry entries[16];
+    struct ldcache_entry *found = entries;
+    size_t nfound;
+
+    if (ldcache_lookup(r->cache, soname, entries, 16,
+                       &nfound) != LDCACHE_SUCCESS) {
+        return NULL;
+    }
+    if (nfound > 16) {
+        found = malloc(nfound * sizeof(*found));
+        if (found == NULL) {
+            err(EXIT_FAILURE, "malloc() failed");
+        }
+        ldcache_lookup(r->cache, soname, found, nfound, &nfound);
+    }
+
+    const char *path = NULL;
+    for (size_t i = 0; i < nfound; i++) {
+        if (ldcache_flags_arch(found[i].flags) != arch) {
+            continue;
+        }
+        if (found[i].hwcap == 0) {
+            path = found[i].value;
+            break;
+        }
+        if (path == NULL) {
+            path = found[i].value;
+        }
+    }
+
+    if (found != entries) {
+        free(found);
+    }
+    return path;
+}
+
+
+/* Resolve the dependencies of object 'index', once. */
+void resolveDeps(struct resolver *r, uint32_t index)
+{
+    struct object *obj = &r->objects[index];
+    if (obj->info == NULL || obj->deps != NULL) {
+        return;
+    }
+
+    const struct soinfo *info = obj->info;
+    enum ldcache_arch arch = ldcache_elf_arch(info->elfclass, info->machine,
+                                              info->flags);
+
+    uint32_t *deps = malloc((info->ndeps ? info->ndeps : 1) *
+                            sizeof(*deps));
+    if (deps == NULL) {
+        err(EXIT_FAILURE, "malloc() failed");
+    }
+
+    for (size_t i = 0; i < info->ndeps; i++) {
+        const char *path = resolveSoname(r, info->deps[i], arch);
+        deps[i] = path ? internObject(r, path) : NOT_FOUND;
+    }
+
+    /* internObject() may have moved objects[]. */
+    r->objects[index].deps = deps;
+}
+
+
+enum format {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+};
+
+
+void printDep(struct outbuf *out, enum format format, bool first,
+              const char *soname, const char *path)
+{
+    if (format == FORMAT_TEXT) {
+        outbuf_char(out, '\t');
+        outbuf_str(out, soname);
+        outbuf_write(out, " => ", 4);
+        outbuf_str(out, path ? path : "not found");
+        outbuf_char(out, '\n');
+        return;
+    }
+
+    if (!first) {
+        outbuf_char(out, ',');
+    }
+    outbuf_char(out, '{');
+    outbuf_json_key(out, "soname", true);
+    outbuf_json_str(out, soname);
+    outbuf_json_key(out, "path", false);
+    if (path != NULL) {
+        outbuf_json_str(out, path);
+    } else {
+        outbuf_str(out, "null");
+    }
+    outbuf_char(out, '}');
+}
+
+
+/* Print the closure of object 'root' breadth first, which is the order
+ * the dynamic linker loads libraries in. Each library is listed once,
+ * under the first soname that pulled it in. Returns false if any
+ * dependency could not be found or parsed. */
+bool printClosure(struct resolver *r, struct outbuf *out,
+                  enum format format, uint32_t root, uint32_t gen)
+{
+    bool ok = true;
+    bool first = true;
+
+    /* Unresolved sonames are listed once per closure too. */
+    const char **missing = NULL;
+    size_t nmissing = 0;
+
+    size_t capacity = r->nobjects;
+    uint32_t *queue = malloc(capacity * sizeof(*queue));
+    if (queue == NULL) {
+        err(EXIT_FAILURE, "malloc() failed");
+    }
+    size_t head = 0, tail = 0;
+
+    if (format == FORMAT_TEXT) {
+        outbuf_str(out, r->objects[root].path);
+        outbuf_write(out, ":\n", 2);
+    } else {
+        outbuf_char(out, '{');
+        outbuf_json_key(out, "file", true);
+        outbuf_json_str(out, r->objects[root].path);
+        outbuf_json_key(out, "closure", false);
+        outbuf_char(out, '[');
+    }
+
+    r->objects[root].seen = gen;
+    queue[tail++] = root;
+
+    while (head < tail) {
+        uint32_t index = queue[head++];
+        resolveDeps(r, index);
+
+        const struct object *obj = &r->objects[index];
+        if (obj->info == NULL) {
+            continue;
+        }
+
+        for (size_t i = 0; i < obj->info->ndeps; i++) {
+            const char *soname = obj->info->deps[i];
+            uint32_t dep = obj->deps[i];
+
+            if (dep == NOT_FOUND) {
+                size_t j = 0;
+                while (j < nmissing && strcmp(missing[j], soname) != 0) {
+                    j++;
+                }
+                if (j < nmissing) {
+                    continue;
+                }
+                missing = realloc(missing, (nmissing + 1) * sizeof(*missing));
+                if (missing == NULL) {
+                    err(EXIT_FAILURE, "realloc() failed");
+                }
+                missing[nmissing++] = soname;
+                printDep(out, format, first, soname, NULL);
+                first = false;
+                ok = false;
+                continue;
+            }
+
+            if (r->objects[dep].seen == gen) {
+                continue;
+            }
+            r->objects[dep].seen = gen;
+
+            /* Resolving the queued objects can add objects, so the
+             * queue may need to grow past the count taken above. */
+            if (tail == capacity) {
+                capacity *= 2;
+                queue = realloc(queue, capacity * sizeof(*queue));
+                if (queue == NULL) {
+                    err(EXIT_FAILURE, "realloc() failed");
+                }
+            }
+            queue[tail++] = dep;
+
+            printDep(out, format, first, soname, r->objects[dep].path);
+            first = false;
+
+            if (r->objects[dep].info == NULL) {
+                ok = false;
+            }
+        }
+    }
+
+    if (format == FORMAT_JSON) {
+        outbuf_write(out, "]}\n", 3);
+    }
+
+    free(missing);
+    free(queue);
+    return ok;
+}
+
+
+void warnObject(const struct object *obj)
+{
+    if (obj->error == SOINFO_ERROR_OPEN) {
+        warnx("open '%s' failed: %s", obj->path, strerror(obj->errnum));
+    } else {
+        warnx("error parsing '%s': %s", obj->path,
+              soinfo_strerror(obj->error));
+    }
+}
+
+
+void usage(const char *prog)
+{
+    errx(EXIT_FAILURE, "usage: %s [-f cache] [-x index] [-o text|json] "
+        "file...", prog);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *path = LDCACHE_DEFAULT_PATH;
+    const char *index = NULL;
+    enum format format = FORMAT_TEXT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:o:x:")) != -1) {
+        switch (opt) {
+            case 'f':
+                path = optarg;
+                break;
+            case 'o':
+                if (strcmp(optarg, "json") == 0) {
+                    format = FORMAT_JSON;
+                } else if (strcmp(optarg, "text") == 0) {
+                    format = FORMAT_TEXT;
+                } else {
+                    errx(EXIT_FAILURE, "unknown output format '%s'",
+                        optarg);
+                }
+                break;
+            case 'x':
+                index = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+
+    struct resolver r = { 0 };
+
+    int flags = index ? 0 : LDCACHE_INDEX;
+    int ret = ldcache_open(&r.cache, path, flags);
+    if (ret == LDCACHE_ERROR_OPEN || ret == LDCACHE_ERROR_MMAP) {
+        err(EXIT_FAILURE, "error loading '%s'", path);
+    }
+    if (ret != LDCACHE_SUCCESS) {
+        errx(EXIT_FAILURE, "error parsing '%s': %s",
+            path, ldcache_strerror(ret));
+    }
+
+    if (index != NULL) {
+        ret = ldcache_index_file(r.cache, index, LDCACHE_INDEX_REBUILD);
+        if (ret == LDCACHE_ERROR_OPEN) {
+            warn("cannot write index '%s'", index);
+        } else if (ret != LDCACHE_SUCCESS) {
+            errx(EXIT_FAILURE, "error indexing '%s': %s",
+                path, ldcache_strerror(ret));
+        }
+    }
+
+    struct outbuf out;
+    if (outbuf_init(&out, STDOUT_FILENO, 0) == -1) {
+        err(EXIT_FAILURE, "malloc() failed");
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        uint32_t root = internObject(&r, argv[i]);
+        if (r.objects[root].info == NULL) {
+            warnObject(&r.objects[root]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        if (!printClosure(&r, &out, format, root, i)) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /* Report libraries that were found but could not be parsed once,
+     * however many closures they appeared in. */
+    for (uint32_t i = 0; i < r.nobjects; i++) {
+        if (r.objects[i].info == NULL && r.objects[i].seen != 0) {
+            warnObject(&r.objects[i]);
+        }
+    }
+
+    if (outbuf_flush(&out) == -1) {
+        err(EXIT_FAILURE, "write() failed");
+    }
+    outbuf_free(&out);
+
+    for (uint32_t i = 0; i < r.nobjects; i++) {
+        free(r.objects[i].path);
+        soinfo_free(r.objects[i].info);
+        free(r.objects[i].deps);
+    }
+    free(r.objects);
+    free(r.slots);
+    ldcache_close(r.cache);
+    return status;
+}
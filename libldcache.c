@@ -0,0 +1,1648 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ldcache.h"
+#include "ldcache_simd.h"
+
+#define CACHEMAGIC_OLD "ld.so-1.7.0"
+#define CACHEMAGIC_NEW "glibc-ld.so.cache1.1"
+#define INDEXMAGIC "ldcache-index1"
+
+/* Values for the low bits of header_new->flags. */
+#define CACHE_FLAGS_ENDIAN_MASK    0x03
+#define CACHE_FLAGS_ENDIAN_UNSET   0x00
+#define CACHE_FLAGS_ENDIAN_INVALID 0x01
+#define CACHE_FLAGS_ENDIAN_LITTLE  0x02
+#define CACHE_FLAGS_ENDIAN_BIG     0x03
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CACHE_FLAGS_ENDIAN_HOST CACHE_FLAGS_ENDIAN_BIG
+#else
+#define CACHE_FLAGS_ENDIAN_HOST CACHE_FLAGS_ENDIAN_LITTLE
+#endif
+
+/* LoongArch only appeared in glibc 2.36's <elf.h>. */
+#ifndef EM_LOONGARCH
+#define EM_LOONGARCH 258
+#define EF_LARCH_ABI_MODIFIER_MASK 0x07
+#define EF_LARCH_ABI_SOFT_FLOAT    0x01
+#define EF_LARCH_ABI_DOUBLE_FLOAT  0x03
+#endif
+
+/* Number of bytes needed to advance 'addr' to the alignment of 'type'. */
+#define ALIGN_TYPE_OFFSET(addr, type) \
+    ((__alignof__(type) - ((addr) & (__alignof__(type) - 1))) & \
+     (__alignof__(type) - 1))
+
+/* Older versions of libc had a very simple format for ld.so.cache. The file
+ * simply listed the number of libary entries, followed by the entries
+ * themselves, followed by a string table holding strings pointed to by the
+ * library entries. This format is summarized below:
+
+        CACHEMAGIC_OLD
+        nlibs
+        libs[0]
+        ...
+        libs[nlibs-1]
+        string[0] -- Address of offset 0 in strtab
+        ...
+        string[n]
+
+ * For glibc 2.2 and beyond, a new format was created so that each
+ * library entry could hold more meta-data about the libraries they
+ * reference. To preserve backwards compatibility, the new format was
+ * embedded in the old format inside its string table (simply moving
+ * all existing strings further down in the string table). This makes
+ * sense for backwards comaptibility because code that could parse the
+ * old format  still works (the offsets for strings pointed to by
+ * the library entries are just larger now).
+ *
+ * However, it adds complications when parsing for the new format
+ * because the new format' header needs to be aligned on an 8 byte
+ * boundary (potentially pushing the start address of the string table
+ * down a few bytes). A summary of the new format embedded in the old
+ * format with annotations on the start address of the string table
+ * can be seen below:
+
+        CACHEMAGIC_OLD
+        nlibs
+        libs[0]
+        ...
+        libs[nlibs-1]
+        pad (align for new format) -- Address of offset 0 in the old strtab
+        CACHEMAGIC_NEW             -- Address of offset 0 in the new strtab
+        nlibs
+        len_strings
+        unused -- 20 bytes reserved for future extensions
+        libs[0]
+        ...
+        libs[newnlibs-1]
+        string[0]
+        ...
+        string[n]
+*/
+
+struct header_old
+{
+  char magic[sizeof(CACHEMAGIC_OLD) - 1];
+  uint32_t nlibs;
+};
+
+struct libentry_old
+{
+  int32_t flags;  /* 0x01 indicated ELF library. */
+  uint32_t key;   /* String table index. */
+  uint32_t value; /* String table index. */
+};
+
+struct header_new
+{
+  char magic[sizeof(CACHEMAGIC_NEW) - 1];
+  uint32_t nlibs;     /* Number of entries.  */
+  uint32_t stringslen; /* Size of string table. */
+  uint8_t flags;      /* Byte order of the cache (glibc 2.33+). */
+  uint8_t padding[3];
+  uint32_t extension_offset; /* File offset of the extension section
+                                (glibc 2.33+), or 0. */
+  uint32_t unused[3]; /* Leave space for future extensions
+                         and align to 8 byte boundary. */
+};
+
+struct libentry_new
+{
+  int32_t flags;        /* Flags bits determine arch and library type. */
+  uint32_t key;         /* String table index. */
+  uint32_t value;       /* String table index. */
+  uint32_t osversion;   /* Required OS version. */
+  uint64_t hwcap;       /* Hwcap entry. */
+};
+
+/* A slot in the open-addressing hash index over the entry keys. Each
+ * distinct key occupies one slot, holding the hash of the key and the
+ * first entry carrying it. The remaining entries with the same key are
+ * chained through the 'next' array, in cache order. Entry indices are
+ * stored off by one so that 0 can mark empty slots and chain ends. */
+struct index_slot
+{
+  uint32_t hash;
+  uint32_t head;
+};
+
+/* Header of an index file written by ldcache_index_file(). It is
+ * followed by the 'nslots' slots and the 'nlibs' entries of the 'next'
+ * array, exactly as they are laid out in memory, so the file can be
+ * used in place once mapped. The cache_* fields tag the index with the
+ * identity of the cache file it was built from. Index files are only
+ * valid on hosts with the same byte order as the one writing them,
+ * which 'byteorder' (always written as 0x01020304) records. */
+struct index_header
+{
+  char magic[sizeof(INDEXMAGIC) - 1];
+  uint16_t version;
+  uint32_t byteorder;
+  uint32_t nlibs;
+  uint32_t nslots;
+  uint32_t unused;
+  uint64_t cache_dev;
+  uint64_t cache_ino;
+  uint64_t cache_size;
+  int64_t cache_mtime_sec;
+  int64_t cache_mtime_nsec;
+};
+
+/* Reference from a key's string table offset back to its entry. */
+struct key_ref
+{
+  uint32_t key;
+  uint32_t index;
+};
+
+enum entry_order {
+    ORDER_UNKNOWN,
+    ORDER_SORTED,
+    ORDER_UNSORTED,
+};
+
+struct ldcache
+{
+  char *path;     /* Path the cache was opened from. */
+  int flags;      /* Flags it was opened with. */
+  struct stat st; /* Identity of the file that is mapped. */
+
+  char *buffer;   /* Start of the cache mapping. */
+  size_t filelen; /* Length of the cache mapping. */
+  char *end;      /* One past the last byte of the mapping. */
+  char *strend;   /* One past the last byte of the string table. */
+
+  struct header_old *header_old; /* NULL for new format only caches. */
+  struct header_new *header_new;
+  struct libentry_new *libs_new;
+  char *strtab;   /* Offset 0 for libentry_new key/value indices. */
+
+  /* Hash index, only built if LDCACHE_INDEX was passed to open. */
+  uint32_t nslots; /* Always a power of two. */
+  struct index_slot *slots;
+  uint32_t *next;
+
+  /* Set when 'slots' and 'next' point into a mapped index file rather
+   * than being allocated. 'index_path' is kept to reapply the file on
+   * refresh. */
+  void *index_map;
+  size_t index_len;
+  char *index_path;
+  int index_flags;
+
+  /* Entry indices grouped by architecture. The entries for arch 'a'
+   * are arch_entries[arch_start[a]] up to arch_entries[arch_start[a+1]]. */
+  uint32_t *arch_entries;
+  uint32_t arch_start[LDCACHE_NARCH + 1];
+
+  /* All entries sorted by key offset, used to map string table hits
+   * back to entries. Built on the first ldcache_search(). */
+  struct key_ref *key_refs;
+
+  /* Whether the entries are in ldconfig order, so that lookups can
+   * binary search them. Checked along with the entries at open time,
+   * or with LDCACHE_LAZY on the first lookup that misses. */
+  enum entry_order order;
+
+  /* Set with LDCACHE_LAZY: entry offsets were not validated at open
+   * time, so each entry is checked when it is accessed. */
+  bool lazy;
+};
+
+
+static bool validatePtr(char *base, size_t limit, char *ptr, size_t offset)
+{
+    if (ptr < base || ptr > base + limit)
+        return false;
+
+    if (offset >= limit - (ptr - base))
+        return false;
+
+    return true;
+}
+
+
+/* Check that the key and value offsets of entry 'index' point inside
+ * the string table. Since the string table is known to end in a '\0',
+ * no string read starting at a valid offset can run past its end. */
+static bool entryValid(const struct ldcache *cache, uint32_t index)
+{
+    const struct libentry_new *lib = &cache->libs_new[index];
+    size_t limit = cache->strend - cache->strtab;
+
+    return lib->key < limit && lib->value < limit;
+}
+
+
+/* Validate the string offsets of every entry at once, storing the
+ * index of the first bad entry in '*bad' on failure. */
+static bool entriesValid(const struct ldcache *cache, size_t *bad)
+{
+    uint32_t nlibs = cache->header_new->nlibs;
+    size_t limit = cache->strend - cache->strtab;
+
+    /* Every 32-bit offset is in bounds of a string table this big. */
+    if (limit > UINT32_MAX) {
+        return true;
+    }
+
+    size_t i = ldcache_find_bad_offset(cache->libs_new, nlibs,
+                                       sizeof(struct libentry_new),
+                                       offsetof(struct libentry_new, key),
+                                       limit);
+    if (i != nlibs) {
+        *bad = i;
+        return false;
+    }
+    return true;
+}
+
+
+/* Validate entry 'index' before its strings are read, unless that was
+ * already done for every entry at open time. Keeping a per-entry
+ * "validated" bit would cost as much to test as the two compares it
+ * saves, so lazily validated entries are simply checked on every
+ * access. */
+static inline bool checkEntry(const struct ldcache *cache, uint32_t index)
+{
+    return !cache->lazy || entryValid(cache, index);
+}
+
+
+/* Compare two sonames the way ldconfig orders them when writing the
+ * cache (glibc's _dl_cache_libcmp()): runs of digits compare
+ * numerically, and digits sort after any other character. */
+static int libcmp(const char *p1, const char *p2)
+{
+    while (*p1 != '\0') {
+        if (*p1 >= '0' && *p1 <= '9') {
+            if (*p2 >= '0' && *p2 <= '9') {
+                /* Must compare this numerically. */
+                int val1 = *p1++ - '0';
+                int val2 = *p2++ - '0';
+                while (*p1 >= '0' && *p1 <= '9')
+                    val1 = val1 * 10 + *p1++ - '0';
+                while (*p2 >= '0' && *p2 <= '9')
+                    val2 = val2 * 10 + *p2++ - '0';
+                if (val1 != val2)
+                    return val1 - val2;
+            } else {
+                return 1;
+            }
+        } else if (*p2 >= '0' && *p2 <= '9') {
+            return -1;
+        } else if (*p1 != *p2) {
+            return *p1 - *p2;
+        } else {
+            p1++;
+            p2++;
+        }
+    }
+    return *p1 - *p2;
+}
+
+
+/* Record whether the entries are in ldconfig's order (descending by
+ * libcmp()), which is what lets lookups binary search them. Every key
+ * is read, so with LDCACHE_LAZY a malformed entry fails the check. */
+static int checkOrder(struct ldcache *cache)
+{
+    uint32_t nlibs = cache->header_new->nlibs;
+    const char *prev = NULL;
+
+    for (uint32_t i = 0; i < nlibs; i++) {
+        if (!checkEntry(cache, i)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        const char *key = cache->strtab + cache->libs_new[i].key;
+        if (prev != NULL && libcmp(prev, key) < 0) {
+            cache->order = ORDER_UNSORTED;
+            return LDCACHE_SUCCESS;
+        }
+        prev = key;
+    }
+
+    cache->order = ORDER_SORTED;
+    return LDCACHE_SUCCESS;
+}
+
+
+static int mapCache(struct ldcache *cache, const char *path, int flags)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return LDCACHE_ERROR_OPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return LDCACHE_ERROR_OPEN;
+    }
+
+    /* An empty (or truncated) file can't hold a valid header, and
+     * mmap() refuses zero length mappings anyway. */
+    if ((size_t)st.st_size < sizeof(struct header_old)) {
+        close(fd);
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    int mapflags = MAP_PRIVATE;
+    if (flags & LDCACHE_MAP_POPULATE) {
+        mapflags |= MAP_POPULATE;
+    }
+
+    char *buffer = mmap(NULL, st.st_size, PROT_READ, mapflags, fd, 0);
+    if (buffer == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return LDCACHE_ERROR_MMAP;
+    }
+    close(fd);
+
+    /* Advice is only a hint, so failing to apply it is not fatal. */
+    if (flags & LDCACHE_MAP_WILLNEED) {
+        madvise(buffer, st.st_size, MADV_WILLNEED);
+    }
+    if (flags & LDCACHE_MAP_SEQUENTIAL) {
+        madvise(buffer, st.st_size, MADV_SEQUENTIAL);
+    }
+    if (flags & LDCACHE_MAP_RANDOM) {
+        madvise(buffer, st.st_size, MADV_RANDOM);
+    }
+
+    cache->st = st;
+    cache->buffer = buffer;
+    cache->filelen = st.st_size;
+    cache->end = buffer + st.st_size;
+    return LDCACHE_SUCCESS;
+}
+
+
+static int parseCache(struct ldcache *cache)
+{
+    char *buffer = cache->buffer;
+    size_t filelen = cache->filelen;
+
+    char *bufptr = buffer;
+    size_t offset = 0;
+    struct header_old *header_old = NULL;
+
+    /* Since glibc 2.32, ldconfig writes caches holding only the new
+     * format by default. The new header then sits at the start of the
+     * file, and there is no old header or libentry_old array to skip
+     * over. Otherwise, expect the new format embedded in the old one. */
+    bool newonly = filelen >= sizeof(CACHEMAGIC_NEW) - 1 &&
+                   memcmp(buffer, CACHEMAGIC_NEW,
+                          sizeof(CACHEMAGIC_NEW) - 1) == 0;
+
+    if (!newonly) {
+        /* Construct pointers to all of the important regions in the
+         * old format: the header, the libentry array, the strtab. */
+        header_old = (struct header_old*)bufptr;
+        offset = sizeof(struct header_old);
+        if (!validatePtr(buffer, filelen, bufptr, offset)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        bufptr += offset;
+
+        if (strncmp(header_old->magic,
+                    CACHEMAGIC_OLD,
+                    sizeof(CACHEMAGIC_OLD) - 1) != 0) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+
+        /* We only use the new format, so the libentry_old array is
+         * skipped over rather than parsed. */
+        offset = (size_t)header_old->nlibs * sizeof(struct libentry_old);
+        if (!validatePtr(buffer, filelen, bufptr, offset)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        bufptr += offset;
+
+        /* The new format's header and all of its library entries are
+         * embedded in the old format's string table. The header itself
+         * is aligned to its natural alignment, so we need to align our
+         * bufptr here to get it to point to the new header. */
+        offset = ALIGN_TYPE_OFFSET((uintptr_t)bufptr, struct header_new);
+        if (!validatePtr(buffer, filelen, bufptr, offset)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        bufptr += offset;
+    }
+
+    /* Construct pointers to all of the important regions in the new
+     * format: the header, the libentry array, and the new strtab
+     * (which starts at the same address as the aligned header_new
+     * pointer). */
+    struct header_new *header_new = (struct header_new*)bufptr;
+    offset = sizeof(struct header_new);
+    if (!validatePtr(buffer, filelen, bufptr, offset)) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+    bufptr += offset;
+
+    if (strncmp(header_new->magic,
+                CACHEMAGIC_NEW,
+                sizeof(CACHEMAGIC_NEW) - 1) != 0) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    /* Caches that record their byte order must match ours. */
+    uint8_t endian = header_new->flags & CACHE_FLAGS_ENDIAN_MASK;
+    if (endian == CACHE_FLAGS_ENDIAN_INVALID ||
+        (endian != CACHE_FLAGS_ENDIAN_UNSET &&
+         endian != CACHE_FLAGS_ENDIAN_HOST)) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    struct libentry_new *libs_new = (struct libentry_new*)bufptr;
+    offset = (size_t)header_new->nlibs * sizeof(struct libentry_new);
+    if (!validatePtr(buffer, filelen, bufptr, offset)) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+    bufptr += offset;
+
+    char *strtab = (char *)header_new;
+
+    /* The strings contained in the string table follow the entries.
+     * They take up the rest of the file, unless glibc 2.33 or later
+     * appended an extension section after them. Its offset is from the
+     * start of the file, even in a compat cache, and glibc's loader
+     * only accepts it 4-byte aligned with room for its header (a magic
+     * and a section count). */
+    if (header_new->stringslen > cache->end - bufptr) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+    bufptr += header_new->stringslen;
+
+    if (bufptr != cache->end) {
+        size_t extension = header_new->extension_offset;
+        if (extension < (size_t)(bufptr - buffer) || extension % 4 != 0 ||
+            extension > filelen ||
+            filelen - extension < 2 * sizeof(uint32_t)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+    }
+
+    /* Make sure the very last character of the string table is a
+     * '\0'. This way, no matter what strings we index in the string
+     * table, we know they will never run beyond the end of the file
+     * buffer when extracting them. */
+    if (*(bufptr - 1) != '\0') {
+        return LDCACHE_ERROR_FORMAT;
+    }
+    cache->strend = bufptr;
+
+    cache->header_old = header_old;
+    cache->header_new = header_new;
+    cache->libs_new = libs_new;
+    cache->strtab = strtab;
+
+    /* Validate all string offsets are within the bounds of the strtab,
+     * and check the entries are sorted, unless that is deferred until
+     * each entry is accessed. */
+    size_t bad;
+    if (!cache->lazy) {
+        if (!entriesValid(cache, &bad)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        checkOrder(cache);
+    }
+
+    return LDCACHE_SUCCESS;
+}
+
+
+/* 32-bit FNV-1a. Sonames are short, so a simple byte-wise hash beats
+ * anything with a heavier setup cost. */
+static uint32_t hashKey(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/* Find the slot holding 'key', or the empty slot where it belongs.
+ * An index read from a file is not trusted, so slots are checked as
+ * they are probed, and NULL is returned if one is out of bounds or
+ * the table has no empty slot to end the probe. */
+static struct index_slot *findSlot(const struct ldcache *cache,
+                                   const char *key, uint32_t hash)
+{
+    uint32_t mask = cache->nslots - 1;
+    uint32_t i = hash & mask;
+
+    for (uint32_t n = 0; n < cache->nslots; n++, i = (i + 1) & mask) {
+        struct index_slot *slot = &cache->slots[i];
+
+        if (slot->head == 0) {
+            return slot;
+        }
+        if (slot->head > cache->header_new->nlibs ||
+            !checkEntry(cache, slot->head - 1)) {
+            return NULL;
+        }
+        if (slot->hash == hash &&
+            strcmp(cache->strtab + cache->libs_new[slot->head - 1].key,
+                   key) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+
+static int buildIndex(struct ldcache *cache)
+{
+    uint32_t nlibs = cache->header_new->nlibs;
+
+    /* Size the table for a load factor of at most 1/2, assuming every
+     * key is distinct. This also guarantees an empty slot exists, so
+     * probing always terminates. */
+    uint32_t nslots = 1;
+    while (nslots < 2 * (uint64_t)nlibs) {
+        if (nslots == UINT32_C(1) << 31) {
+            return LDCACHE_ERROR_NOMEM;
+        }
+        nslots <<= 1;
+    }
+
+    cache->slots = calloc(nslots, sizeof(*cache->slots));
+    cache->next = calloc(nlibs ? nlibs : 1, sizeof(*cache->next));
+    if (cache->slots == NULL || cache->next == NULL) {
+        return LDCACHE_ERROR_NOMEM;
+    }
+    cache->nslots = nslots;
+
+    /* Insert in reverse so that prepending to each chain leaves the
+     * entries for a key in cache order. */
+    for (uint32_t i = nlibs; i-- > 0;) {
+        if (!checkEntry(cache, i)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+
+        const char *key = cache->strtab + cache->libs_new[i].key;
+        uint32_t hash = hashKey(key);
+        struct index_slot *slot = findSlot(cache, key, hash);
+        if (slot == NULL) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+
+        cache->next[i] = slot->head;
+        slot->hash = hash;
+        slot->head = i + 1;
+    }
+
+    return LDCACHE_SUCCESS;
+}
+
+
+/* Partition the entries by architecture with a counting sort, which
+ * keeps each partition in cache order. */
+static int buildArchViews(struct ldcache *cache)
+{
+    uint32_t nlibs = cache->header_new->nlibs;
+    uint32_t count[LDCACHE_NARCH] = { 0 };
+
+    cache->arch_entries = malloc((nlibs ? nlibs : 1) * sizeof(uint32_t));
+    if (cache->arch_entries == NULL) {
+        return LDCACHE_ERROR_NOMEM;
+    }
+
+    for (uint32_t i = 0; i < nlibs; i++) {
+        count[ldcache_flags_arch(cache->libs_new[i].flags)]++;
+    }
+
+    cache->arch_start[0] = 0;
+    for (int a = 0; a < LDCACHE_NARCH; a++) {
+        cache->arch_start[a + 1] = cache->arch_start[a] + count[a];
+        count[a] = cache->arch_start[a];
+    }
+
+    for (uint32_t i = 0; i < nlibs; i++) {
+        enum ldcache_arch a = ldcache_flags_arch(cache->libs_new[i].flags);
+        cache->arch_entries[count[a]++] = i;
+    }
+
+    return LDCACHE_SUCCESS;
+}
+
+
+static int compareKeyRefs(const void *a, const void *b)
+{
+    const struct key_ref *ra = a;
+    const struct key_ref *rb = b;
+
+    if (ra->key != rb->key) {
+        return ra->key < rb->key ? -1 : 1;
+    }
+    return ra->index < rb->index ? -1 : ra->index > rb->index;
+}
+
+
+static int buildKeyRefs(struct ldcache *cache)
+{
+    uint32_t nlibs = cache->header_new->nlibs;
+
+    cache->key_refs = malloc((nlibs ? nlibs : 1) * sizeof(struct key_ref));
+    if (cache->key_refs == NULL) {
+        return LDCACHE_ERROR_NOMEM;
+    }
+
+    for (uint32_t i = 0; i < nlibs; i++) {
+        cache->key_refs[i].key = cache->libs_new[i].key;
+        cache->key_refs[i].index = i;
+    }
+    qsort(cache->key_refs, nlibs, sizeof(struct key_ref), compareKeyRefs);
+    return LDCACHE_SUCCESS;
+}
+
+
+/* Return the position of the first key_ref with a key offset of at
+ * least 'key'. */
+static uint32_t lowerBoundKeyRef(const struct ldcache *cache, uint32_t key)
+{
+    uint32_t left = 0;
+    uint32_t right = cache->header_new->nlibs;
+
+    while (left < right) {
+        uint32_t middle = left + (right - left) / 2;
+        if (cache->key_refs[middle].key < key) {
+            left = middle + 1;
+        } else {
+            right = middle;
+        }
+    }
+    return left;
+}
+
+
+/* Find the longest run of literal characters in the fnmatch() pattern
+ * 'pattern'. Every key matching the pattern must contain that run, and
+ * must start with it if 'anchored' is set. Escaped characters simply
+ * end a run, so the result is conservative. */
+static void longestLiteral(const char *pattern, const char **lit,
+                           size_t *litlen, bool *anchored)
+{
+    const char *run = pattern;
+
+    *lit = pattern;
+    *litlen = 0;
+    *anchored = false;
+
+    for (const char *p = pattern;; p++) {
+        const char *next = NULL;
+
+        switch (*p) {
+            case '\0':
+            case '*':
+            case '?':
+                next = p + 1;
+                break;
+            case '\\':
+                next = p[1] != '\0' ? p + 2 : p + 1;
+                break;
+            case '[': {
+                /* A bracket expression runs to the next ']', not
+                 * counting one that immediately follows '[' or '[!'.
+                 * Without a closing ']' the '[' is a plain character. */
+                const char *q = p + 1;
+                if (*q == '!' || *q == '^')
+                    q++;
+                if (*q == ']')
+                    q++;
+                q = strchr(q, ']');
+                if (q != NULL)
+                    next = q + 1;
+                break;
+            }
+        }
+
+        if (next == NULL) {
+            continue;
+        }
+
+        if ((size_t)(p - run) > *litlen) {
+            *lit = run;
+            *litlen = p - run;
+            *anchored = (run == pattern);
+        }
+
+        if (*p == '\0') {
+            return;
+        }
+        run = next;
+        p = next - 1;
+    }
+}
+
+
+/* Binary search for 'soname' in the entry array, which ldconfig sorts
+ * in descending libcmp() order. On success, '*first' is set to the
+ * first entry comparing equal to 'soname' and true is returned.
+ *
+ * The order is normally checked when the cache is opened, but a lazily
+ * opened cache may not have been checked yet, so every probe is also
+ * checked against the keys bracketing the current search range. If a
+ * probe falls outside of them the cache is not in ldconfig order,
+ * 'cache->order' is set and LDCACHE_ERROR_NOTFOUND is returned so the
+ * caller can fall back to a linear scan. */
+static int searchSorted(struct ldcache *cache, const char *soname,
+                        uint32_t *first)
+{
+    const char *lkey = NULL; /* Key just left of the range, if any. */
+    const char *rkey = NULL; /* Key just right of the range, if any. */
+    int64_t left = 0;
+    int64_t right = (int64_t)cache->header_new->nlibs - 1;
+
+    while (left <= right) {
+        uint32_t middle = (left + right) / 2;
+        if (!checkEntry(cache, middle)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        const char *key = cache->strtab + cache->libs_new[middle].key;
+
+        if ((lkey != NULL && libcmp(lkey, key) < 0) ||
+            (rkey != NULL && libcmp(key, rkey) < 0)) {
+            cache->order = ORDER_UNSORTED;
+            return LDCACHE_ERROR_NOTFOUND;
+        }
+
+        int cmpres = libcmp(soname, key);
+        if (cmpres == 0) {
+            /* Walk back to the first of any equal entries. */
+            while (middle > 0) {
+                if (!checkEntry(cache, middle - 1)) {
+                    return LDCACHE_ERROR_FORMAT;
+                }
+                if (libcmp(soname, cache->strtab +
+                           cache->libs_new[middle - 1].key) != 0) {
+                    break;
+                }
+                middle--;
+            }
+            *first = middle;
+            return LDCACHE_SUCCESS;
+        }
+
+        if (cmpres < 0) {
+            left = middle + 1;
+            lkey = key;
+        } else {
+            right = (int64_t)middle - 1;
+            rkey = key;
+        }
+    }
+
+    return LDCACHE_ERROR_NOTFOUND;
+}
+
+
+/* Fill 'entry' from entry 'index', which must already have passed
+ * checkEntry(). */
+static void fillEntry(const struct ldcache *cache, uint32_t index,
+                      struct ldcache_entry *entry)
+{
+    const struct libentry_new *lib = &cache->libs_new[index];
+
+    entry->index = index;
+    entry->flags = lib->flags;
+    entry->osversion = lib->osversion;
+    entry->hwcap = lib->hwcap;
+    entry->key = cache->strtab + lib->key;
+    entry->value = cache->strtab + lib->value;
+}
+
+
+int ldcache_open(struct ldcache **cache, const char *path, int flags)
+{
+    if (cache == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (path == NULL) {
+        path = LDCACHE_DEFAULT_PATH;
+    }
+
+    struct ldcache *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return LDCACHE_ERROR_NOMEM;
+    }
+
+    c->path = strdup(path);
+    if (c->path == NULL) {
+        free(c);
+        return LDCACHE_ERROR_NOMEM;
+    }
+    c->flags = flags;
+
+    int ret = mapCache(c, path, flags);
+    if (ret != LDCACHE_SUCCESS) {
+        free(c->path);
+        free(c);
+        return ret;
+    }
+
+    c->lazy = (flags & LDCACHE_LAZY) != 0;
+
+    ret = parseCache(c);
+    if (ret != LDCACHE_SUCCESS) {
+        ldcache_close(c);
+        return ret;
+    }
+
+    if (flags & LDCACHE_INDEX) {
+        ret = buildIndex(c);
+        if (ret != LDCACHE_SUCCESS) {
+            ldcache_close(c);
+            return ret;
+        }
+    }
+
+    if (flags & LDCACHE_ARCH_VIEWS) {
+        ret = buildArchViews(c);
+        if (ret != LDCACHE_SUCCESS) {
+            ldcache_close(c);
+            return ret;
+        }
+    }
+
+    *cache = c;
+    return LDCACHE_SUCCESS;
+}
+
+
+void ldcache_close(struct ldcache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    free(cache->path);
+    munmap(cache->buffer, cache->filelen);
+    if (cache->index_map != NULL) {
+        munmap(cache->index_map, cache->index_len);
+    } else {
+        free(cache->slots);
+        free(cache->next);
+    }
+    free(cache->index_path);
+    free(cache->arch_entries);
+    free(cache->key_refs);
+    free(cache);
+}
+
+
+/* Report whether 'st' still describes the file that is mapped. An
+ * atomic replacement by ldconfig changes the inode, and an in-place
+ * rewrite changes the size or modification time. */
+static bool sameFile(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev &&
+           a->st_ino == b->st_ino &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+
+int ldcache_refresh(struct ldcache *cache, int *changed)
+{
+    if (cache == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (changed != NULL) {
+        *changed = 0;
+    }
+
+    struct stat st;
+    if (stat(cache->path, &st) == -1) {
+        return LDCACHE_ERROR_OPEN;
+    }
+
+    if (sameFile(&st, &cache->st)) {
+        return LDCACHE_SUCCESS;
+    }
+
+    /* Load the new snapshot completely before touching the old one, so
+     * that a failed reload leaves the handle usable. The identity that
+     * gets recorded is the one of the file actually mapped, so a file
+     * replaced again after the stat() above is caught next time. */
+    struct ldcache *fresh;
+    int ret = ldcache_open(&fresh, cache->path, cache->flags);
+    if (ret != LDCACHE_SUCCESS) {
+        return ret;
+    }
+
+    /* An index file that can't be used just leaves lookups to the
+     * fallbacks, which is no reason to keep the old snapshot. */
+    if (cache->index_path != NULL) {
+        ret = ldcache_index_file(fresh, cache->index_path,
+                                 cache->index_flags);
+        if (ret == LDCACHE_ERROR_NOMEM) {
+            ldcache_close(fresh);
+            return ret;
+        }
+    }
+
+    struct ldcache old = *cache;
+    *cache = *fresh;
+    *fresh = old;
+    ldcache_close(fresh);
+
+    if (changed != NULL) {
+        *changed = 1;
+    }
+    return LDCACHE_SUCCESS;
+}
+
+
+int ldcache_validate(struct ldcache *cache, size_t *bad)
+{
+    if (cache == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    size_t index;
+    if (!entriesValid(cache, &index)) {
+        if (bad != NULL) {
+            *bad = index;
+        }
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    /* Everything is known to be valid now, so stop checking entries
+     * as they are accessed. */
+    cache->lazy = false;
+    if (cache->order == ORDER_UNKNOWN) {
+        checkOrder(cache);
+    }
+    return LDCACHE_SUCCESS;
+}
+
+
+/* Fill in the header of an index of 'nslots' slots over 'cache'. */
+static void indexHeader(const struct ldcache *cache, uint32_t nslots,
+                        struct index_header *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, INDEXMAGIC, sizeof(hdr->magic));
+    hdr->version = 1;
+    hdr->byteorder = 0x01020304;
+    hdr->nlibs = cache->header_new->nlibs;
+    hdr->nslots = nslots;
+    hdr->cache_dev = cache->st.st_dev;
+    hdr->cache_ino = cache->st.st_ino;
+    hdr->cache_size = cache->st.st_size;
+    hdr->cache_mtime_sec = cache->st.st_mtim.tv_sec;
+    hdr->cache_mtime_nsec = cache->st.st_mtim.tv_nsec;
+}
+
+
+/* Map the index file at 'path' and, if it was built from exactly the
+ * file 'cache' has mapped, switch the handle's index over to it. Only
+ * the header and size are checked here. The slots are checked as they
+ * are probed, so that using the index stays O(1). */
+static int mapIndex(struct ldcache *cache, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return LDCACHE_ERROR_OPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return LDCACHE_ERROR_OPEN;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct index_header)) {
+        close(fd);
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return LDCACHE_ERROR_MMAP;
+    }
+    close(fd);
+
+    struct index_header want;
+    uint32_t nslots = ((struct index_header *)map)->nslots;
+    indexHeader(cache, nslots, &want);
+
+    /* Comparing the whole header checks the magic, byte order and tag
+     * at once. */
+    uint64_t len = sizeof(want) +
+                   (uint64_t)nslots * sizeof(struct index_slot) +
+                   (uint64_t)want.nlibs * sizeof(uint32_t);
+    if (memcmp(map, &want, sizeof(want)) != 0 ||
+        nslots == 0 || (nslots & (nslots - 1)) != 0 ||
+        (uint64_t)st.st_size != len) {
+        munmap(map, st.st_size);
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    if (cache->index_map != NULL) {
+        munmap(cache->index_map, cache->index_len);
+    } else {
+        free(cache->slots);
+        free(cache->next);
+    }
+    cache->index_map = map;
+    cache->index_len = st.st_size;
+    cache->nslots = nslots;
+    cache->slots = (struct index_slot *)(map + sizeof(want));
+    cache->next = (uint32_t *)(cache->slots + nslots);
+    return LDCACHE_SUCCESS;
+}
+
+
+static bool writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/* Write the in-memory index of 'cache' to 'path'. It goes to a
+ * temporary file in the same directory first, so that readers only
+ * ever see a complete index. */
+static int writeIndex(const struct ldcache *cache, const char *path)
+{
+    char *tmp;
+    if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+        return LDCACHE_ERROR_NOMEM;
+    }
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        int saved = errno;
+        free(tmp);
+        errno = saved;
+        return LDCACHE_ERROR_OPEN;
+    }
+
+    struct index_header hdr;
+    indexHeader(cache, cache->nslots, &hdr);
+
+    bool ok = fchmod(fd, 0644) == 0 &&
+              writeAll(fd, &hdr, sizeof(hdr)) &&
+              writeAll(fd, cache->slots,
+                       (size_t)cache->nslots * sizeof(*cache->slots)) &&
+              writeAll(fd, cache->next,
+                       (size_t)hdr.nlibs * sizeof(*cache->next));
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+
+    int saved = errno;
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    errno = saved;
+    return ok ? LDCACHE_SUCCESS : LDCACHE_ERROR_OPEN;
+}
+
+
+int ldcache_index_file(struct ldcache *cache, const char *path, int flags)
+{
+    if (cache == NULL || path == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (cache->index_path == NULL ||
+        strcmp(cache->index_path, path) != 0) {
+        char *copy = strdup(path);
+        if (copy == NULL) {
+            return LDCACHE_ERROR_NOMEM;
+        }
+        free(cache->index_path);
+        cache->index_path = copy;
+    }
+    cache->index_flags = flags;
+
+    int ret = mapIndex(cache, path);
+    if (ret == LDCACHE_SUCCESS || !(flags & LDCACHE_INDEX_REBUILD)) {
+        return ret;
+    }
+
+    /* Rebuild from scratch, even over an index mapped earlier, since
+     * the stale file is about to be replaced. */
+    if (cache->index_map != NULL) {
+        munmap(cache->index_map, cache->index_len);
+        cache->index_map = NULL;
+    } else {
+        free(cache->slots);
+        free(cache->next);
+    }
+    cache->slots = NULL;
+    cache->next = NULL;
+    cache->nslots = 0;
+
+    ret = buildIndex(cache);
+    if (ret != LDCACHE_SUCCESS) {
+        free(cache->slots);
+        free(cache->next);
+        cache->slots = NULL;
+        cache->next = NULL;
+        cache->nslots = 0;
+        return ret;
+    }
+
+    return writeIndex(cache, path);
+}
+
+
+const char *ldcache_strerror(int error)
+{
+    switch (error) {
+        case LDCACHE_SUCCESS:
+            return "success";
+        case LDCACHE_ERROR_INVAL:
+            return "invalid argument";
+        case LDCACHE_ERROR_OPEN:
+            return "unable to open cache";
+        case LDCACHE_ERROR_MMAP:
+            return "unable to map cache";
+        case LDCACHE_ERROR_NOMEM:
+            return "out of memory";
+        case LDCACHE_ERROR_FORMAT:
+            return "malformed cache";
+        case LDCACHE_ERROR_NOTFOUND:
+            return "no matching entry";
+    }
+    return "unknown error";
+}
+
+
+int ldcache_info(const struct ldcache *cache, struct ldcache_info *info)
+{
+    if (cache == NULL || info == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    memset(info, 0, sizeof(*info));
+    if (cache->header_old != NULL) {
+        info->format = LDCACHE_FORMAT_COMPAT;
+        memcpy(info->old_magic, cache->header_old->magic,
+               sizeof(CACHEMAGIC_OLD) - 1);
+        info->old_nlibs = cache->header_old->nlibs;
+    } else {
+        info->format = LDCACHE_FORMAT_NEW;
+    }
+    memcpy(info->new_magic, cache->header_new->magic,
+           sizeof(CACHEMAGIC_NEW) - 1);
+    info->new_nlibs = cache->header_new->nlibs;
+    info->stringslen = cache->header_new->stringslen;
+    info->filelen = cache->filelen;
+    return LDCACHE_SUCCESS;
+}
+
+
+size_t ldcache_count(const struct ldcache *cache)
+{
+    return cache->header_new->nlibs;
+}
+
+
+int ldcache_entry(const struct ldcache *cache, size_t index,
+                  struct ldcache_entry *entry)
+{
+    if (cache == NULL || entry == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (index >= cache->header_new->nlibs) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (!checkEntry(cache, index)) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    fillEntry(cache, index, entry);
+    return LDCACHE_SUCCESS;
+}
+
+
+int ldcache_lookup(struct ldcache *cache, const char *soname,
+                   struct ldcache_entry *entries, size_t max,
+                   size_t *nfound)
+{
+    if (cache == NULL || soname == NULL || nfound == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    size_t n = 0;
+
+    if (cache->slots != NULL) {
+        struct index_slot *slot = findSlot(cache, soname, hashKey(soname));
+        if (slot == NULL) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+
+        /* Chains run in cache order, which also guarantees a chain
+         * read from an index file ends. */
+        for (uint32_t i = slot->head; i != 0; i = cache->next[i - 1]) {
+            if (!checkEntry(cache, i - 1)) {
+                return LDCACHE_ERROR_FORMAT;
+            }
+            if (n < max) {
+                fillEntry(cache, i - 1, &entries[n]);
+            }
+            n++;
+
+            uint32_t next = cache->next[i - 1];
+            if (next != 0 && (next <= i || next > cache->header_new->nlibs)) {
+                return LDCACHE_ERROR_FORMAT;
+            }
+        }
+
+        *nfound = n;
+        return n == 0 ? LDCACHE_ERROR_NOTFOUND : LDCACHE_SUCCESS;
+    }
+
+    /* Without an index, binary search the sorted entries. libcmp()
+     * treats numerically equal keys such as "libfoo.so.01" and
+     * "libfoo.so.1" as equal, so the run of equal entries is filtered
+     * with strcmp() to give the same results as a scan. */
+    uint32_t first;
+    int ret = LDCACHE_ERROR_NOTFOUND;
+    if (cache->order != ORDER_UNSORTED) {
+        ret = searchSorted(cache, soname, &first);
+        if (ret == LDCACHE_ERROR_FORMAT) {
+            return ret;
+        }
+    }
+
+    /* An entry out of order off the search path goes unnoticed by the
+     * search, so a miss only counts once the whole order is known. A
+     * lazily opened cache checks it on its first miss. */
+    if (ret == LDCACHE_ERROR_NOTFOUND && cache->order == ORDER_UNKNOWN &&
+        checkOrder(cache) != LDCACHE_SUCCESS) {
+        return LDCACHE_ERROR_FORMAT;
+    }
+
+    if (ret == LDCACHE_SUCCESS) {
+        for (uint32_t i = first; i < cache->header_new->nlibs; i++) {
+            if (!checkEntry(cache, i)) {
+                return LDCACHE_ERROR_FORMAT;
+            }
+
+            const char *key = cache->strtab + cache->libs_new[i].key;
+
+            if (libcmp(soname, key) != 0) {
+                break;
+            }
+            if (strcmp(soname, key) != 0) {
+                continue;
+            }
+            if (n < max) {
+                fillEntry(cache, i, &entries[n]);
+            }
+            n++;
+        }
+
+        *nfound = n;
+        return n == 0 ? LDCACHE_ERROR_NOTFOUND : LDCACHE_SUCCESS;
+    }
+
+    if (cache->order != ORDER_UNSORTED) {
+        *nfound = 0;
+        return LDCACHE_ERROR_NOTFOUND;
+    }
+
+    for (uint32_t i = 0; i < cache->header_new->nlibs; i++) {
+        if (!checkEntry(cache, i)) {
+            return LDCACHE_ERROR_FORMAT;
+        }
+        if (strcmp(cache->strtab + cache->libs_new[i].key, soname) != 0) {
+            continue;
+        }
+        if (n < max) {
+            fillEntry(cache, i, &entries[n]);
+        }
+        n++;
+    }
+
+    *nfound = n;
+    return n == 0 ? LDCACHE_ERROR_NOTFOUND : LDCACHE_SUCCESS;
+}
+
+
+/* Names for each architecture, and the suffix ldconfig prints for it
+ * after the library type. */
+static const struct {
+    const char *name;
+    const char *suffix;
+} archs[LDCACHE_NARCH] = {
+    [LDCACHE_ARCH_NONE] = { "none", "" },
+    [LDCACHE_ARCH_SPARC_LIB64] = { "sparc64", ",64bit" },
+    [LDCACHE_ARCH_IA64_LIB64] = { "ia64", ",IA-64" },
+    [LDCACHE_ARCH_X8664_LIB64] = { "x86-64", ",x86-64" },
+    [LDCACHE_ARCH_S390_LIB64] = { "s390x", ",64bit" },
+    [LDCACHE_ARCH_POWERPC_LIB64] = { "ppc64", ",64bit" },
+    [LDCACHE_ARCH_MIPS64_LIBN32] = { "mips64-n32", ",N32" },
+    [LDCACHE_ARCH_MIPS64_LIBN64] = { "mips64", ",64bit" },
+    [LDCACHE_ARCH_X8664_LIBX32] = { "x32", ",x32" },
+    [LDCACHE_ARCH_ARM_LIBHF] = { "arm-hf", ",hard-float" },
+    [LDCACHE_ARCH_AARCH64_LIB64] = { "aarch64", ",AArch64" },
+    [LDCACHE_ARCH_ARM_LIBSF] = { "arm-sf", ",soft-float" },
+    [LDCACHE_ARCH_MIPS_LIB32_NAN2008] = { "mips-nan2008", ",nan2008" },
+    [LDCACHE_ARCH_MIPS64_LIBN32_NAN2008] = { "mips64-n32-nan2008", ",N32,nan2008" },
+    [LDCACHE_ARCH_MIPS64_LIBN64_NAN2008] = { "mips64-nan2008", ",64bit,nan2008" },
+    [LDCACHE_ARCH_RISCV_FLOAT_ABI_SOFT] = { "riscv-soft", ",soft-float" },
+    [LDCACHE_ARCH_RISCV_FLOAT_ABI_DOUBLE] = { "riscv-double", ",double-float" },
+    [LDCACHE_ARCH_LARCH_FLOAT_ABI_SOFT] = { "loongarch-soft", ",soft-float" },
+    [LDCACHE_ARCH_LARCH_FLOAT_ABI_DOUBLE] = { "loongarch-double", ",double-float" },
+    [LDCACHE_ARCH_UNKNOWN] = { "unknown", NULL },
+};
+
+
+enum ldcache_arch ldcache_flags_arch(int32_t flags)
+{
+    uint32_t arch = (flags & LDCACHE_FLAG_ARCH_MASK) >> LDCACHE_FLAG_ARCH_SHIFT;
+
+    if (arch >= LDCACHE_ARCH_UNKNOWN) {
+        return LDCACHE_ARCH_UNKNOWN;
+    }
+    return arch;
+}
+
+
+/* Mirrors how ldconfig derives an entry's flags from the ELF header
+ * (sysdeps/.../readelflib.c in glibc). */
+enum ldcache_arch ldcache_elf_arch(int elfclass, int machine, uint32_t flags)
+{
+    bool is64 = elfclass == ELFCLASS64;
+
+    switch (machine) {
+        case EM_X86_64:
+            return is64 ? LDCACHE_ARCH_X8664_LIB64 : LDCACHE_ARCH_X8664_LIBX32;
+        case EM_AARCH64:
+            return is64 ? LDCACHE_ARCH_AARCH64_LIB64 : LDCACHE_ARCH_NONE;
+        case EM_IA_64:
+            return LDCACHE_ARCH_IA64_LIB64;
+        case EM_S390:
+            return is64 ? LDCACHE_ARCH_S390_LIB64 : LDCACHE_ARCH_NONE;
+        case EM_PPC64:
+            return LDCACHE_ARCH_POWERPC_LIB64;
+        case EM_SPARC:
+        case EM_SPARC32PLUS:
+        case EM_SPARCV9:
+            return is64 ? LDCACHE_ARCH_SPARC_LIB64 : LDCACHE_ARCH_NONE;
+        case EM_ARM:
+            if (flags & EF_ARM_ABI_FLOAT_HARD) {
+                return LDCACHE_ARCH_ARM_LIBHF;
+            }
+            if (flags & EF_ARM_ABI_FLOAT_SOFT) {
+                return LDCACHE_ARCH_ARM_LIBSF;
+            }
+            return LDCACHE_ARCH_NONE;
+        case EM_MIPS: {
+            bool nan2008 = (flags & EF_MIPS_NAN2008) != 0;
+            if (is64) {
+                return nan2008 ? LDCACHE_ARCH_MIPS64_LIBN64_NAN2008
+                               : LDCACHE_ARCH_MIPS64_LIBN64;
+            }
+            if (flags & EF_MIPS_ABI2) {
+                return nan2008 ? LDCACHE_ARCH_MIPS64_LIBN32_NAN2008
+                               : LDCACHE_ARCH_MIPS64_LIBN32;
+            }
+            return nan2008 ? LDCACHE_ARCH_MIPS_LIB32_NAN2008
+                           : LDCACHE_ARCH_NONE;
+        }
+        case EM_RISCV:
+            switch (flags & EF_RISCV_FLOAT_ABI) {
+                case EF_RISCV_FLOAT_ABI_SOFT:
+                    return LDCACHE_ARCH_RISCV_FLOAT_ABI_SOFT;
+                case EF_RISCV_FLOAT_ABI_DOUBLE:
+                    return LDCACHE_ARCH_RISCV_FLOAT_ABI_DOUBLE;
+            }
+            return LDCACHE_ARCH_NONE;
+        case EM_LOONGARCH:
+            switch (flags & EF_LARCH_ABI_MODIFIER_MASK) {
+                case EF_LARCH_ABI_SOFT_FLOAT:
+                    return LDCACHE_ARCH_LARCH_FLOAT_ABI_SOFT;
+                case EF_LARCH_ABI_DOUBLE_FLOAT:
+                    return LDCACHE_ARCH_LARCH_FLOAT_ABI_DOUBLE;
+            }
+            return LDCACHE_ARCH_NONE;
+    }
+    return LDCACHE_ARCH_NONE;
+}
+
+
+const char *ldcache_arch_name(enum ldcache_arch arch)
+{
+    if (arch < 0 || arch >= LDCACHE_NARCH) {
+        return NULL;
+    }
+    return archs[arch].name;
+}
+
+
+int ldcache_arch_parse(const char *name, enum ldcache_arch *arch)
+{
+    if (name == NULL || arch == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    for (int a = 0; a < LDCACHE_NARCH; a++) {
+        if (strcmp(name, archs[a].name) == 0) {
+            *arch = a;
+            return LDCACHE_SUCCESS;
+        }
+    }
+    return LDCACHE_ERROR_NOTFOUND;
+}
+
+
+int ldcache_flags_str(int32_t flags, char *buf, size_t len)
+{
+    const char *type;
+    switch (flags & LDCACHE_FLAG_TYPE_MASK) {
+        case LDCACHE_FLAG_LIBC4:
+            type = "libc4";
+            break;
+        case LDCACHE_FLAG_ELF:
+            type = "ELF";
+            break;
+        case LDCACHE_FLAG_ELF_LIBC5:
+            type = "libc5";
+            break;
+        case LDCACHE_FLAG_ELF_LIBC6:
+            type = "libc6";
+            break;
+        default:
+            type = "unknown";
+            break;
+    }
+
+    enum ldcache_arch arch = ldcache_flags_arch(flags);
+    if (arch == LDCACHE_ARCH_UNKNOWN) {
+        return snprintf(buf, len, "%s,%d", type,
+                        flags & LDCACHE_FLAG_ARCH_MASK);
+    }
+    return snprintf(buf, len, "%s%s", type, archs[arch].suffix);
+}
+
+
+int ldcache_arch_view(struct ldcache *cache, enum ldcache_arch arch,
+                      const uint32_t **indices, size_t *count)
+{
+    if (cache == NULL || indices == NULL || count == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (arch < 0 || arch >= LDCACHE_NARCH) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    if (cache->arch_entries == NULL) {
+        int ret = buildArchViews(cache);
+        if (ret != LDCACHE_SUCCESS) {
+            return ret;
+        }
+    }
+
+    *indices = cache->arch_entries + cache->arch_start[arch];
+    *count = cache->arch_start[arch + 1] - cache->arch_start[arch];
+    return LDCACHE_SUCCESS;
+}
+
+
+int ldcache_search(struct ldcache *cache, const char *pattern,
+                   struct ldcache_entry *entries, size_t max,
+                   size_t *nfound)
+{
+    if (cache == NULL || pattern == NULL || nfound == NULL) {
+        return LDCACHE_ERROR_INVAL;
+    }
+
+    uint32_t nlibs = cache->header_new->nlibs;
+
+    if (cache->key_refs == NULL) {
+        int ret = buildKeyRefs(cache);
+        if (ret != LDCACHE_SUCCESS) {
+            return ret;
+        }
+    }
+
+    /* Candidate entries are marked in a bitmap so that each is only
+     * matched once, and results come out in cache order. */
+    uint8_t *marks = calloc(nlibs / 8 + 1, 1);
+    if (marks == NULL) {
+        return LDCACHE_ERROR_NOMEM;
+    }
+
+    const char *lit;
+    size_t litlen;
+    bool anchored;
+    longestLiteral(pattern, &lit, &litlen, &anchored);
+
+    if (litlen == 0) {
+        memset(marks, 0xff, nlibs / 8 + 1);
+    } else {
+        /* The strings follow the entry array. Keys pointing anywhere
+         * before that are not in the scanned region, so they are left
+         * for fnmatch() to decide. */
+        const char *region = (const char *)(cache->libs_new + nlibs);
+        uint32_t regionoff = region - cache->strtab;
+        uint32_t r;
+
+        for (r = 0; r < nlibs && cache->key_refs[r].key < regionoff; r++) {
+            uint32_t i = cache->key_refs[r].index;
+            marks[i / 8] |= 1 << (i % 8);
+        }
+
+        /* For every occurrence of the literal, the keys containing it
+         * start between the beginning of the enclosing string and the
+         * hit itself (ldconfig may point keys into the tail of a path
+         * string). When the literal is a prefix of the pattern, keys
+         * must start exactly at the hit. */
+        const char *p = region;
+        const char *hit;
+        while ((hit = ldcache_find_literal(p, cache->strend - p,
+                                           lit, litlen)) != NULL) {
+            uint32_t hitoff = hit - cache->strtab;
+            uint32_t from = hitoff;
+
+            if (!anchored) {
+                const char *nul = memrchr(region, '\0', hit - region);
+                from = (nul != NULL ? nul + 1 : region) - cache->strtab;
+            }
+
+            for (r = lowerBoundKeyRef(cache, from);
+                 r < nlibs && cache->key_refs[r].key <= hitoff; r++) {
+                uint32_t i = cache->key_refs[r].index;
+                marks[i / 8] |= 1 << (i % 8);
+            }
+            p = hit + 1;
+        }
+    }
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < nlibs; i++) {
+        if (!(marks[i / 8] & (1 << (i % 8)))) {
+            continue;
+        }
+        if (!checkEntry(cache, i)) {
+            free(marks);
+            return LDCACHE_ERROR_FORMAT;
+        }
+        if (fnmatch(pattern, cache->strtab + cache->libs_new[i].key, 0) != 0) {
+            continue;
+        }
+        if (n < max) {
+            fillEntry(cache, i, &entries[n]);
+        }
+        n++;
+    }
+
+    free(marks);
+    *nfound = n;
+    return n == 0 ? LDCACHE_ERROR_NOTFOUND : LDCACHE_SUCCESS;
+}
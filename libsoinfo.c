@@ -0,0 +1,2313 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SOINFO_LIBELF
+#include <gelf.h>
+#endif
+
+/* The batch loader uses io_uring with the native parser, unless built
+ * with SOINFO_NOURING. */
+#if !defined(SOINFO_LIBELF) && !defined(SOINFO_NOURING)
+#define SOINFO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#include "soinfo.h"
+
+/* Arena chunks are carved up in multiples of ARENA_ALIGN bytes, which
+ * suits any of the ELF structures read into them. The first chunk is
+ * ARENA_CHUNK bytes and each further one twice the previous; on reset
+ * only the newest chunk is kept, unless it exceeds ARENA_KEEP, so that
+ * one huge object does not pin its memory for the rest of a scan. */
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK 4096
+#define ARENA_KEEP  (1024 * 1024)
+
+struct soinfo_chunk
+{
+  struct soinfo_chunk *prev;
+  size_t len;
+  size_t cap;
+  unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+
+void soinfo_arena_init(struct soinfo_arena *arena)
+{
+    arena->chunk = NULL;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+
+void soinfo_arena_reset(struct soinfo_arena *arena)
+{
+    struct soinfo_chunk *c = arena->chunk;
+    if (c != NULL) {
+        struct soinfo_chunk *prev = c->prev;
+        while (prev != NULL) {
+            struct soinfo_chunk *next = prev->prev;
+            free(prev);
+            prev = next;
+        }
+        c->prev = NULL;
+        c->len = 0;
+
+        if (c->cap > ARENA_KEEP) {
+            free(c);
+            arena->chunk = NULL;
+        }
+    }
+    arena->used = 0;
+}
+
+
+void soinfo_arena_free(struct soinfo_arena *arena)
+{
+    soinfo_arena_reset(arena);
+    free(arena->chunk);
+    arena->chunk = NULL;
+}
+
+
+static void *arenaAlloc(struct soinfo_arena *arena, size_t size)
+{
+    if (size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    struct soinfo_chunk *c = arena->chunk;
+    if (c == NULL || size > c->cap - c->len) {
+        size_t cap = c != NULL ? 2 * c->cap : ARENA_CHUNK;
+        while (cap < size) {
+            cap *= 2;
+        }
+
+        struct soinfo_chunk *next = malloc(sizeof(*next) + cap);
+        if (next == NULL) {
+            return NULL;
+        }
+        next->prev = c;
+        next->len = 0;
+        next->cap = cap;
+        arena->chunk = c = next;
+    }
+
+    void *p = c->data + c->len;
+    c->len += size;
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    return p;
+}
+
+
+/* Copy the 'len' bytes at 'str' into the arena as a string. */
+static const char *arenaString(struct soinfo_arena *arena, const char *str,
+                               size_t len)
+{
+    char *copy = arenaAlloc(arena, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+
+/* Allocate a soinfo with room for 'ndeps' dependencies. */
+static struct soinfo *arenaInfo(struct soinfo_arena *arena, size_t ndeps)
+{
+    if (ndeps > (SIZE_MAX / 2 - sizeof(struct soinfo)) / sizeof(char *)) {
+        return NULL;
+    }
+
+    struct soinfo *si = arenaAlloc(arena,
+                                   sizeof(*si) + ndeps * sizeof(char *));
+    if (si != NULL) {
+        si->soname = NULL;
+        si->ndeps = ndeps;
+        si->deps = (const char **)(si + 1);
+        si->nread = 0;
+    }
+    return si;
+}
+
+#ifdef SOINFO_LIBELF
+
+/* Copy the soname and dependencies found in 'e' into the arena, since
+ * libelf's copies go away with the Elf handle. */
+static int collectInfo(Elf *e, struct soinfo_arena *arena,
+                       struct soinfo **info)
+{
+    GElf_Ehdr ehdr;
+    if (gelf_getehdr(e, &ehdr) == NULL) {
+        return SOINFO_ERROR_FORMAT;
+    }
+
+    Elf_Scn *scn = NULL;
+    GElf_Shdr shdr;
+    while ((scn = elf_nextscn(e, scn)) != NULL) {
+        if (gelf_getshdr(scn, &shdr) == NULL) {
+            return SOINFO_ERROR_FORMAT;
+        }
+
+        if (shdr.sh_type == SHT_DYNAMIC) {
+            break;
+        }
+    }
+
+    if (scn == NULL) {
+        return SOINFO_ERROR_NODYN;
+    }
+
+    Elf_Data *data = elf_getdata(scn, NULL);
+    if (data == NULL) {
+        return SOINFO_ERROR_FORMAT;
+    }
+
+    /* The data holds the object's own Elf32_Dyn or Elf64_Dyn entries,
+     * not GElf_Dyn ones. */
+    size_t entsize = gelf_fsize(e, ELF_T_DYN, 1, EV_CURRENT);
+    if (entsize == 0) {
+        return SOINFO_ERROR_FORMAT;
+    }
+    size_t num_entries = data->d_size / entsize;
+
+    /* The section header links the dynamic section to its string
+     * table, which (unlike DT_STRTAB) needs no address translation. */
+    size_t strtabndx = shdr.sh_link;
+
+    size_t sonameptr = 0;
+    bool has_soname = false;
+    size_t *depptr = arenaAlloc(arena, num_entries * sizeof(*depptr));
+    if (depptr == NULL) {
+        return SOINFO_ERROR_NOMEM;
+    }
+    size_t numdeps = 0;
+
+    for (size_t i = 0; i < num_entries; i++) {
+        GElf_Dyn dyn;
+        if (gelf_getdyn(data, i, &dyn) == NULL) {
+            return SOINFO_ERROR_FORMAT;
+        }
+
+        switch (dyn.d_tag) {
+            case DT_SONAME:
+                sonameptr = dyn.d_un.d_val;
+                has_soname = true;
+                break;
+            case DT_NEEDED:
+                depptr[numdeps++] = dyn.d_un.d_val;
+                break;
+        }
+    }
+
+    struct soinfo *si = arenaInfo(arena, numdeps);
+    if (si == NULL) {
+        return SOINFO_ERROR_NOMEM;
+    }
+    si->elfclass = ehdr.e_ident[EI_CLASS];
+    si->machine = ehdr.e_machine;
+    si->flags = ehdr.e_flags;
+
+    if (has_soname) {
+        const char *soname = elf_strptr(e, strtabndx, sonameptr);
+        if (soname == NULL) {
+            return SOINFO_ERROR_FORMAT;
+        }
+        si->soname = arenaString(arena, soname, strlen(soname));
+        if (si->soname == NULL) {
+            return SOINFO_ERROR_NOMEM;
+        }
+    }
+
+    for (size_t i = 0; i < numdeps; i++) {
+        const char *dep = elf_strptr(e, strtabndx, depptr[i]);
+        if (dep == NULL) {
+            return SOINFO_ERROR_FORMAT;
+        }
+        si->deps[i] = arenaString(arena, dep, strlen(dep));
+        if (si->deps[i] == NULL) {
+            return SOINFO_ERROR_NOMEM;
+        }
+    }
+
+    *info = si;
+    return SOINFO_SUCCESS;
+}
+
+
+static int loadLibelf(const char *path, struct soinfo_arena *arena,
+                      struct soinfo **info, struct stat *st)
+{
+    if (elf_version(EV_CURRENT) == EV_NONE) {
+        return SOINFO_ERROR_ELF;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return SOINFO_ERROR_OPEN;
+    }
+
+    if (fstat(fd, st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return SOINFO_ERROR_OPEN;
+    }
+
+    Elf *e = elf_begin(fd, ELF_C_READ, NULL);
+    if (e == NULL) {
+        close(fd);
+        return SOINFO_ERROR_ELF;
+    }
+
+    int ret = SOINFO_ERROR_ELF;
+    if (elf_kind(e) == ELF_K_ELF) {
+        ret = collectInfo(e, arena, info);
+    }
+
+    elf_end(e);
+    close(fd);
+    return ret;
+}
+
+#else /* !SOINFO_LIBELF */
+
+/* Reading an object through its program headers, as the dynamic
+ * linker does, needs none of libelf's generality: the dynamic segment
+ * is found through PT_DYNAMIC, DT_STRTAB is translated to a file
+ * offset through the PT_LOAD segment holding it, and the soname and
+ * DT_NEEDED strings are bounds checked and copied out. Section headers
+ * are never read (except for the extended program header count), so
+ * stripped objects work too.
+ *
+ * The parser doesn't read the file itself: parseStep() runs until it
+ * needs bytes it hasn't been given, and returns PARSE_MORE with the
+ * range it wants. The caller fetches the range however it likes (and
+ * may supply more than was asked for), hands it over with parseGive()
+ * and calls parseStep() again. That lets the same parser run over a
+ * mapping, over pread(), or over reads queued on an io_uring for many
+ * files at once.
+ *
+ * Mapped, the parser is given the whole rest of the file at once.
+ * With SOINFO_PREAD only the byte ranges it looks at are read: the ELF
+ * header, the program headers, the dynamic segment and a window of
+ * the string table around each string needed. That is a few KB even
+ * for objects of hundreds of MB, which matters on cold network storage
+ * where faulting in a mapping reads ahead far more than is used.
+ *
+ * Objects of either class and byte order are handled. Multi-byte
+ * fields are read with memcpy(), since nothing guarantees the offsets
+ * in a (possibly corrupt) file are aligned. */
+
+/* Initial size of the string table window read with SOINFO_PREAD. The
+ * soname and DT_NEEDED strings are usually within a few hundred bytes
+ * of each other, so one read tends to cover them all. */
+#define STRWINDOW 512
+
+/* How many of the ranges given to the parser it remembers. */
+#define NRANGES 4
+
+/* Returned by parseStep() when it needs more of the file. */
+#define PARSE_MORE (-1)
+
+struct elf_file
+{
+  uint64_t len;
+  bool is64;
+  bool swap; /* The object's byte order differs from ours. */
+};
+
+static uint64_t getN(const struct elf_file *f, const unsigned char *p,
+                     size_t size)
+{
+    switch (size) {
+        case 2: {
+            uint16_t v;
+            memcpy(&v, p, 2);
+            return f->swap ? __builtin_bswap16(v) : v;
+        }
+        case 4: {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return f->swap ? __builtin_bswap32(v) : v;
+        }
+        default: {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            return f->swap ? __builtin_bswap64(v) : v;
+        }
+    }
+}
+
+/* Read 'field' of the Elf32_'type' or Elf64_'type' structure at 'p',
+ * depending on the object's class. */
+#define FIELD(f, p, type, field) \
+    ((f)->is64 ? getN((f), (p) + offsetof(Elf64_##type, field), \
+                      sizeof(((Elf64_##type *)0)->field)) \
+               : getN((f), (p) + offsetof(Elf32_##type, field), \
+                      sizeof(((Elf32_##type *)0)->field)))
+
+#define SIZEOF(f, type) \
+    ((f)->is64 ? sizeof(Elf64_##type) : sizeof(Elf32_##type))
+
+/* Check that 'len' bytes at 'off' lie inside the file. */
+static bool inFile(const struct elf_file *f, uint64_t off, uint64_t len)
+{
+    return off <= f->len && len <= f->len - off;
+}
+
+
+/* Read exactly 'len' bytes at 'off' into 'buf'. */
+static int readAt(int fd, void *buf, uint64_t off, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *)buf + done, len - done, off + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return SOINFO_ERROR_OPEN;
+        }
+        if (n == 0) {
+            /* The file was truncated under us. */
+            return SOINFO_ERROR_FORMAT;
+        }
+        done += n;
+    }
+    return SOINFO_SUCCESS;
+}
+
+
+/* Translate the virtual address 'vaddr' to a file offset through the
+ * PT_LOAD segment containing it, also returning how many bytes of the
+ * segment's file image follow it. */
+static bool vaddrToOffset(const struct elf_file *f, const unsigned char *phdrs,
+                          size_t phnum, size_t phentsize, uint64_t vaddr,
+                          uint64_t *off, uint64_t *avail)
+{
+    for (size_t i = 0; i < phnum; i++) {
+        const unsigned char *ph = phdrs + i * phentsize;
+        if (FIELD(f, ph, Phdr, p_type) != PT_LOAD) {
+            continue;
+        }
+
+        uint64_t start = FIELD(f, ph, Phdr, p_vaddr);
+        uint64_t filesz = FIELD(f, ph, Phdr, p_filesz);
+        if (vaddr < start || vaddr - start >= filesz) {
+            continue;
+        }
+
+        *off = FIELD(f, ph, Phdr, p_offset) + (vaddr - start);
+        *avail = filesz - (vaddr - start);
+        return true;
+    }
+    return false;
+}
+
+
+/* The dynamic entries the parser looks at. */
+struct dyn_info
+{
+  size_t numdeps;
+  uint64_t strtab;
+  uint64_t strsz;
+  uint64_t soname;
+  bool has_strtab;
+  bool has_strsz;
+  bool has_soname;
+};
+
+enum parse_state {
+    PARSE_EHDR,
+    PARSE_SHDR,    /* Reading the PN_XNUM program header count. */
+    PARSE_PHDRS,
+    PARSE_DYNAMIC,
+    PARSE_STRINGS,
+};
+
+/* A part of the file given to the parser. */
+struct elf_range
+{
+  uint64_t off;
+  size_t len;
+  const unsigned char *p;
+};
+
+struct elf_parse
+{
+  struct elf_file f;
+  enum parse_state state;
+
+  /* Holds the result, and whatever the caller reads for the parser. */
+  struct soinfo_arena *arena;
+
+  /* With PARSE_MORE: the range wanted next. */
+  uint64_t off;
+  size_t want;
+
+  /* The ranges given last, which must stay valid until the parse is
+   * done; the next one replaces ranges[next % NRANGES]. */
+  struct elf_range ranges[NRANGES];
+  size_t next;
+
+  const unsigned char *ehdr;
+  const unsigned char *phdrs;
+  size_t phnum;
+  size_t phentsize;
+
+  struct dyn_info di;
+  uint64_t *needed;
+  uint64_t strtab;
+  uint64_t strsz;
+
+  /* The result, with 'done' of its strings copied, the soname first. */
+  struct soinfo *si;
+  size_t done;
+};
+
+/* Start parsing a file of 'len' bytes. */
+static void parseInit(struct elf_parse *p, uint64_t len,
+                      struct soinfo_arena *arena)
+{
+    memset(p, 0, sizeof(*p));
+    p->f.len = len;
+    p->arena = arena;
+}
+
+
+/* Give the parser the 'len' bytes of the file at 'off'. */
+static void parseGive(struct elf_parse *p, uint64_t off,
+                      const unsigned char *buf, size_t len)
+{
+    struct elf_range *r = &p->ranges[p->next++ % NRANGES];
+    r->off = off;
+    r->len = len;
+    r->p = buf;
+}
+
+
+/* Return the 'len' bytes at 'off' if they have been given, or NULL
+ * after recording them as wanted. */
+static const unsigned char *parseGet(struct elf_parse *p, uint64_t off,
+                                     uint64_t len)
+{
+    static const unsigned char empty[1];
+    if (len == 0) {
+        return empty;
+    }
+
+    for (size_t i = 0; i < NRANGES; i++) {
+        const struct elf_range *r = &p->ranges[i];
+        if (r->p != NULL && off >= r->off && off - r->off <= r->len &&
+            len <= r->len - (off - r->off)) {
+            return r->p + (off - r->off);
+        }
+    }
+
+    p->off = off;
+    p->want = len;
+    return NULL;
+}
+
+
+/* Find the string at file offset 'start', which must end before 'end'
+ * (the end of the string table). When it isn't wholly within what has
+ * been given, a window starting at it is wanted, twice the size of
+ * the part already seen. */
+static int findString(struct elf_parse *p, uint64_t start, uint64_t end,
+                      const char **str, size_t *len)
+{
+    size_t seen = 0;
+    for (size_t i = 0; i < NRANGES; i++) {
+        const struct elf_range *r = &p->ranges[i];
+        if (r->p == NULL || start < r->off || start - r->off >= r->len) {
+            continue;
+        }
+
+        const unsigned char *s = r->p + (start - r->off);
+        size_t avail = r->len - (start - r->off);
+        if (avail > end - start) {
+            avail = end - start;
+        }
+        const unsigned char *nul = memchr(s, '\0', avail);
+        if (nul != NULL) {
+            *str = (const char *)s;
+            *len = nul - s;
+            return SOINFO_SUCCESS;
+        }
+        if (start + avail == end) {
+            return SOINFO_ERROR_FORMAT;
+        }
+        if (avail > seen) {
+            seen = avail;
+        }
+    }
+
+    size_t want = seen >= STRWINDOW ? 2 * seen : STRWINDOW;
+    p->off = start;
+    p->want = want < end - start ? want : end - start;
+    return PARSE_MORE;
+}
+
+
+/* Record one dynamic entry, returning false at DT_NULL. */
+static inline bool addDyn(struct dyn_info *di, uint64_t *needed,
+                          uint64_t tag, uint64_t val)
+{
+    switch (tag) {
+        case DT_NULL:
+            return false;
+        case DT_STRTAB:
+            di->strtab = val;
+            di->has_strtab = true;
+            break;
+        case DT_STRSZ:
+            di->strsz = val;
+            di->has_strsz = true;
+            break;
+        case DT_SONAME:
+            di->soname = val;
+            di->has_soname = true;
+            break;
+        case DT_NEEDED:
+            needed[di->numdeps++] = val;
+            break;
+    }
+    return true;
+}
+
+#define NOSWAP(x) (x)
+
+/* Define readDyn<suffix>(), which scans the 'ndyn' entries of type
+ * 'Dyn' at 'p' up to DT_NULL, converting each field with 'conv', and
+ * stores the DT_NEEDED values in 'needed'. Each class and byte order
+ * gets its own copy, so that the loop carries no per-field checks of
+ * either; entries are copied out since 'p' need not be aligned. */
+#define DEFINE_READ_DYN(suffix, Dyn, conv) \
+    static void readDyn##suffix(const unsigned char *p, size_t ndyn, \
+                                struct dyn_info *di, uint64_t *needed) \
+    { \
+        for (size_t i = 0; i < ndyn; i++) { \
+            Dyn dyn; \
+            memcpy(&dyn, p + i * sizeof(Dyn), sizeof(Dyn)); \
+            if (!addDyn(di, needed, conv(dyn.d_tag), \
+                        conv(dyn.d_un.d_val))) { \
+                break; \
+            } \
+        } \
+    }
+
+DEFINE_READ_DYN(32, Elf32_Dyn, NOSWAP)
+DEFINE_READ_DYN(32Swap, Elf32_Dyn, __builtin_bswap32)
+DEFINE_READ_DYN(64, Elf64_Dyn, NOSWAP)
+DEFINE_READ_DYN(64Swap, Elf64_Dyn, __builtin_bswap64)
+
+/* The common case of a 64-bit object in our byte order whose dynamic
+ * segment is suitably aligned, as it is whenever the object is sane,
+ * is read in place. */
+static void readDynNative(const Elf64_Dyn *dyn, size_t ndyn,
+                          struct dyn_info *di, uint64_t *needed)
+{
+    for (size_t i = 0; i < ndyn; i++) {
+        if (!addDyn(di, needed, dyn[i].d_tag, dyn[i].d_un.d_val)) {
+            break;
+        }
+    }
+}
+
+
+static void readDyn(const struct elf_file *f, const unsigned char *p,
+                    size_t ndyn, struct dyn_info *di, uint64_t *needed)
+{
+    memset(di, 0, sizeof(*di));
+
+    if (f->is64 && !f->swap &&
+        (uintptr_t)p % __alignof__(Elf64_Dyn) == 0) {
+        readDynNative((const Elf64_Dyn *)p, ndyn, di, needed);
+    } else if (f->is64) {
+        (f->swap ? readDyn64Swap : readDyn64)(p, ndyn, di, needed);
+    } else {
+        (f->swap ? readDyn32Swap : readDyn32)(p, ndyn, di, needed);
+    }
+}
+
+
+/* Advance the parse as far as the ranges given allow. Returns
+ * PARSE_MORE when the 'want' bytes at 'off' are needed, otherwise
+ * SOINFO_SUCCESS with the result in 'si', or an error. */
+static int parseStep(struct elf_parse *p)
+{
+    struct elf_file *f = &p->f;
+
+    switch (p->state) {
+        case PARSE_EHDR: {
+            /* Enough for either class; the file is checked to really be
+             * large enough for its class below. */
+            uint64_t len = f->len < sizeof(Elf64_Ehdr) ? f->len
+                                                       : sizeof(Elf64_Ehdr);
+            const unsigned char *ehdr = parseGet(p, 0, len);
+            if (ehdr == NULL) {
+                return PARSE_MORE;
+            }
+
+            if (memcmp(ehdr, ELFMAG, SELFMAG) != 0 ||
+                (ehdr[EI_CLASS] != ELFCLASS32 &&
+                 ehdr[EI_CLASS] != ELFCLASS64) ||
+                (ehdr[EI_DATA] != ELFDATA2LSB &&
+                 ehdr[EI_DATA] != ELFDATA2MSB)) {
+                return SOINFO_ERROR_ELF;
+            }
+            f->is64 = ehdr[EI_CLASS] == ELFCLASS64;
+            f->swap = ehdr[EI_DATA] != (__BYTE_ORDER__ ==
+                                        __ORDER_LITTLE_ENDIAN__ ?
+                                        ELFDATA2LSB : ELFDATA2MSB);
+            if (!inFile(f, 0, SIZEOF(f, Ehdr))) {
+                return SOINFO_ERROR_ELF;
+            }
+
+            p->ehdr = ehdr;
+            p->phentsize = FIELD(f, ehdr, Ehdr, e_phentsize);
+            p->phnum = FIELD(f, ehdr, Ehdr, e_phnum);
+
+            /* With PN_XNUM, the real count is in section header 0. */
+            p->state = p->phnum == PN_XNUM ? PARSE_SHDR : PARSE_PHDRS;
+        }
+        /* fall through */
+        case PARSE_SHDR:
+            if (p->state == PARSE_SHDR) {
+                uint64_t shoff = FIELD(f, p->ehdr, Ehdr, e_shoff);
+                if (shoff == 0 || !inFile(f, shoff, SIZEOF(f, Shdr))) {
+                    return SOINFO_ERROR_FORMAT;
+                }
+                const unsigned char *shdr = parseGet(p, shoff,
+                                                     SIZEOF(f, Shdr));
+                if (shdr == NULL) {
+                    return PARSE_MORE;
+                }
+                p->phnum = FIELD(f, shdr, Shdr, sh_info);
+                p->state = PARSE_PHDRS;
+            }
+        /* fall through */
+        case PARSE_PHDRS: {
+            /* Relocatable objects have no program headers at all. */
+            if (p->phnum == 0) {
+                return SOINFO_ERROR_NODYN;
+            }
+            if (p->phentsize < SIZEOF(f, Phdr) ||
+                p->phnum > f->len / p->phentsize) {
+                return SOINFO_ERROR_FORMAT;
+            }
+
+            uint64_t phoff = FIELD(f, p->ehdr, Ehdr, e_phoff);
+            uint64_t len = (uint64_t)p->phnum * p->phentsize;
+            if (!inFile(f, phoff, len)) {
+                return SOINFO_ERROR_FORMAT;
+            }
+            p->phdrs = parseGet(p, phoff, len);
+            if (p->phdrs == NULL) {
+                return PARSE_MORE;
+            }
+            p->state = PARSE_DYNAMIC;
+        }
+        /* fall through */
+        case PARSE_DYNAMIC: {
+            const unsigned char *ph = NULL;
+            for (size_t i = 0; i < p->phnum; i++) {
+                ph = p->phdrs + i * p->phentsize;
+                if (FIELD(f, ph, Phdr, p_type) == PT_DYNAMIC) {
+                    break;
+                }
+                ph = NULL;
+            }
+            if (ph == NULL) {
+                return SOINFO_ERROR_NODYN;
+            }
+
+            uint64_t off = FIELD(f, ph, Phdr, p_offset);
+            uint64_t filesz = FIELD(f, ph, Phdr, p_filesz);
+            if (!inFile(f, off, filesz)) {
+                return SOINFO_ERROR_FORMAT;
+            }
+            const unsigned char *dynamic = parseGet(p, off, filesz);
+            if (dynamic == NULL) {
+                return PARSE_MORE;
+            }
+
+            /* Room for every entry being DT_NEEDED. */
+            size_t ndyn = filesz / SIZEOF(f, Dyn);
+            p->needed = arenaAlloc(p->arena, ndyn * sizeof(*p->needed));
+            if (p->needed == NULL) {
+                return SOINFO_ERROR_NOMEM;
+            }
+
+            struct dyn_info *di = &p->di;
+            readDyn(f, dynamic, ndyn, di, p->needed);
+
+            if (!di->has_strtab && (di->has_soname || di->numdeps > 0)) {
+                return SOINFO_ERROR_FORMAT;
+            }
+
+            p->strsz = di->strsz;
+            if (di->has_strtab) {
+                uint64_t avail;
+                if (!vaddrToOffset(f, p->phdrs, p->phnum, p->phentsize,
+                                   di->strtab, &p->strtab, &avail) ||
+                    !inFile(f, p->strtab, avail)) {
+                    return SOINFO_ERROR_FORMAT;
+                }
+                if (!di->has_strsz || p->strsz > avail) {
+                    p->strsz = avail;
+                }
+            }
+
+            p->si = arenaInfo(p->arena, di->numdeps);
+            if (p->si == NULL) {
+                return SOINFO_ERROR_NOMEM;
+            }
+            p->si->elfclass = f->is64 ? ELFCLASS64 : ELFCLASS32;
+            p->si->machine = FIELD(f, p->ehdr, Ehdr, e_machine);
+            p->si->flags = FIELD(f, p->ehdr, Ehdr, e_flags);
+            p->state = PARSE_STRINGS;
+        }
+        /* fall through */
+        case PARSE_STRINGS: {
+            const struct dyn_info *di = &p->di;
+            size_t nstrings = di->has_soname + di->numdeps;
+            for (; p->done < nstrings; p->done++) {
+                uint64_t off;
+                const char **copy;
+                if (di->has_soname && p->done == 0) {
+                    off = di->soname;
+                    copy = &p->si->soname;
+                } else {
+                    size_t i = p->done - di->has_soname;
+                    off = p->needed[i];
+                    copy = &p->si->deps[i];
+                }
+                if (off >= p->strsz) {
+                    return SOINFO_ERROR_FORMAT;
+                }
+
+                const char *str;
+                size_t len;
+                int ret = findString(p, p->strtab + off, p->strtab + p->strsz,
+                                     &str, &len);
+                if (ret != SOINFO_SUCCESS) {
+                    return ret;
+                }
+                *copy = arenaString(p->arena, str, len);
+                if (*copy == NULL) {
+                    return SOINFO_ERROR_NOMEM;
+                }
+            }
+            return SOINFO_SUCCESS;
+        }
+    }
+    return SOINFO_ERROR_INVAL;
+}
+
+
+/* Run the parser to the end, giving it the rest of the mapping 'map'
+ * whenever it asks for more, or reading what it asks for from 'fd' if
+ * there is no mapping. */
+static int parseSync(struct elf_parse *p, int fd, const unsigned char *map,
+                     uint64_t *nread)
+{
+    int ret;
+    while ((ret = parseStep(p)) == PARSE_MORE) {
+        if (map != NULL) {
+            parseGive(p, p->off, map + p->off, p->f.len - p->off);
+            continue;
+        }
+
+        unsigned char *buf = arenaAlloc(p->arena, p->want);
+        if (buf == NULL) {
+            return SOINFO_ERROR_NOMEM;
+        }
+        ret = readAt(fd, buf, p->off, p->want);
+        if (ret != SOINFO_SUCCESS) {
+            return ret;
+        }
+        *nread += p->want;
+        parseGive(p, p->off, buf, p->want);
+    }
+    return ret;
+}
+
+
+static int loadNative(const char *path, int flags, struct soinfo_arena *arena,
+                      struct soinfo **info, struct stat *st)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return SOINFO_ERROR_OPEN;
+    }
+
+    if (fstat(fd, st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return SOINFO_ERROR_OPEN;
+    }
+
+    /* Also rules out the empty files mmap() refuses. */
+    if (!S_ISREG(st->st_mode) || st->st_size < EI_NIDENT) {
+        close(fd);
+        return SOINFO_ERROR_ELF;
+    }
+
+    struct elf_parse p;
+    parseInit(&p, st->st_size, arena);
+
+    const unsigned char *map = NULL;
+    uint64_t nread = 0;
+    int ret;
+    if (!(flags & SOINFO_PREAD)) {
+        void *m = mmap(NULL, p.f.len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            close(fd);
+            return SOINFO_ERROR_OPEN;
+        }
+        map = m;
+    }
+    ret = parseSync(&p, fd, map, &nread);
+
+    int saved = errno;
+    if (map != NULL) {
+        munmap((void *)map, p.f.len);
+    }
+    close(fd);
+    errno = saved;
+
+    if (ret == SOINFO_SUCCESS) {
+        p.si->nread = nread;
+        *info = p.si;
+    }
+    return ret;
+}
+
+#endif /* SOINFO_LIBELF */
+
+
+/* Load 'path' with whichever backend was built, also returning the
+ * identity of the file actually parsed in '*st'. */
+static int loadFile(const char *path, int flags, struct soinfo_arena *arena,
+                    struct soinfo **info, struct stat *st)
+{
+#ifdef SOINFO_LIBELF
+    (void)flags;
+    return loadLibelf(path, arena, info, st);
+#else
+    return loadNative(path, flags, arena, info, st);
+#endif
+}
+
+
+int soinfo_load_arena(struct soinfo **info, const char *path, int flags,
+                      struct soinfo_arena *arena)
+{
+    if (info == NULL || path == NULL || arena == NULL) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+    struct stat st;
+    return loadFile(path, flags, arena, info, &st);
+}
+
+
+int soinfo_load(struct soinfo **info, const char *path, int flags)
+{
+    struct soinfo_arena arena;
+    soinfo_arena_init(&arena);
+
+    struct soinfo *si;
+    int ret = soinfo_load_arena(&si, path, flags, &arena);
+    if (ret != SOINFO_SUCCESS) {
+        int saved = errno;
+        soinfo_arena_free(&arena);
+        errno = saved;
+        return ret;
+    }
+
+    /* Move the result into a block of its own, so that it outlives
+     * the arena and soinfo_free() is a single free(). */
+    size_t len = sizeof(*si) + si->ndeps * sizeof(char *);
+    if (si->soname != NULL) {
+        len += strlen(si->soname) + 1;
+    }
+    for (size_t i = 0; i < si->ndeps; i++) {
+        len += strlen(si->deps[i]) + 1;
+    }
+
+    struct soinfo *copy = malloc(len);
+    if (copy == NULL) {
+        soinfo_arena_free(&arena);
+        return SOINFO_ERROR_NOMEM;
+    }
+    *copy = *si;
+    copy->deps = (const char **)(copy + 1);
+
+    char *p = (char *)(copy->deps + si->ndeps);
+    if (si->soname != NULL) {
+        copy->soname = strcpy(p, si->soname);
+        p += strlen(p) + 1;
+    }
+    for (size_t i = 0; i < si->ndeps; i++) {
+        copy->deps[i] = strcpy(p, si->deps[i]);
+        p += strlen(p) + 1;
+    }
+
+    soinfo_arena_free(&arena);
+    *info = copy;
+    return SOINFO_SUCCESS;
+}
+
+
+void soinfo_free(struct soinfo *info)
+{
+    free(info);
+}
+
+
+/* The result cache file is a header followed by records, each written
+ * with a single append and never modified afterwards. A record holds
+ * the identity of a file, its path and what was parsed from it; a
+ * newer record for the same device and inode supersedes older ones.
+ * Records carry a checksum, so a torn append (from a crash, or a full
+ * disk) is recognized and cut off the next time the cache is opened.
+ * Everything is in host byte order, which the header records.
+ *
+ * The records present when the cache is opened are mapped, and an
+ * in-memory table indexes the newest record for each device and inode,
+ * so that a hit costs a stat() and a probe; the result points into the
+ * record. Compaction rewrites the file, through a temporary file and a
+ * rename, with only the records whose file still exists unchanged,
+ * dropping the oldest ones as well while the file exceeds its cap. */
+
+#define RESULTMAGIC "soinfo-cache1"
+#define RESULT_VERSION 1
+#define RESULT_BYTEORDER 0x01020304
+#define RESULT_CAP_DEFAULT (16 * 1024 * 1024)
+
+struct result_header
+{
+  char magic[14];
+  uint16_t version;
+  uint32_t byteorder;
+  uint32_t unused;
+};
+
+/* The identity of a file. ctime is included because, unlike mtime, it
+ * cannot be set back by whatever rewrote the file. */
+struct result_key
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t ctime_sec;
+  int64_t ctime_nsec;
+};
+
+struct result_record
+{
+  uint32_t len;   /* Of the whole record, a multiple of 8. */
+  uint32_t check; /* FNV-1a of everything after this field. */
+  struct result_key key;
+  uint32_t elfclass;
+  uint32_t machine;
+  uint32_t flags;
+  uint32_t ndeps;
+  uint32_t has_soname;
+  uint32_t unused;
+  /* Followed by the path, the soname if any and the dependencies,
+   * each NUL terminated, then padding. */
+};
+
+/* A record appended since the cache was opened. */
+struct result_added
+{
+  struct result_added *next;
+  uint64_t rec[]; /* The struct result_record. */
+};
+
+struct soinfo_cache
+{
+  pthread_mutex_t lock;
+  char *path;
+  int fd;            /* Open for appending, or -1 if read-only. */
+  size_t cap;
+
+  void *map;         /* The file as it was when opened. */
+  size_t maplen;
+  uint64_t filelen;  /* Including what was appended since. */
+  uint64_t dead;     /* Bytes taken by superseded records. */
+
+  /* The newest record for each device and inode, pointing into the
+   * mapping or into 'added'. Open addressing, at most 3/4 full. */
+  const struct result_record **slots;
+  size_t nslots;
+  size_t nrecords;
+  struct result_added *added;
+};
+
+
+static uint32_t fnv1a(const void *buf, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char *p = buf; len > 0; p++, len--) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static void makeKey(const struct stat *st, struct result_key *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+    key->ctime_sec = st->st_ctim.tv_sec;
+    key->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+
+static uint32_t recordCheck(const struct result_record *rec)
+{
+    return fnv1a((const unsigned char *)rec + offsetof(struct result_record,
+                                                       key),
+                 rec->len - offsetof(struct result_record, key));
+}
+
+
+/* Return the record at 'p' if it is complete and intact, with all the
+ * strings it claims to hold, or NULL. */
+static const struct result_record *checkRecord(const unsigned char *p,
+                                               size_t avail)
+{
+    const struct result_record *rec = (const struct result_record *)p;
+
+    if (avail < sizeof(*rec) || rec->len < sizeof(*rec) ||
+        rec->len > avail || rec->len % 8 != 0 ||
+        rec->check != recordCheck(rec)) {
+        return NULL;
+    }
+
+    const char *s = (const char *)(rec + 1);
+    const char *end = (const char *)rec + rec->len;
+    uint64_t nstrings = 1 + (rec->has_soname != 0) + (uint64_t)rec->ndeps;
+    for (uint64_t i = 0; i < nstrings; i++) {
+        const char *nul = memchr(s, '\0', end - s);
+        if (nul == NULL) {
+            return NULL;
+        }
+        s = nul + 1;
+    }
+    return rec;
+}
+
+
+static size_t keySlot(const struct soinfo_cache *cache, uint64_t dev,
+                      uint64_t ino)
+{
+    uint64_t h = (dev * 0x9e3779b97f4a7c15ull) ^ ino;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 32;
+    return h & (cache->nslots - 1);
+}
+
+
+/* Find the slot of the record for 'dev' and 'ino', or the empty slot
+ * where it belongs. */
+static const struct result_record **findRecord(struct soinfo_cache *cache,
+                                               uint64_t dev, uint64_t ino)
+{
+    size_t i = keySlot(cache, dev, ino);
+    while (cache->slots[i] != NULL &&
+           (cache->slots[i]->key.dev != dev ||
+            cache->slots[i]->key.ino != ino)) {
+        i = (i + 1) & (cache->nslots - 1);
+    }
+    return &cache->slots[i];
+}
+
+
+static bool insertRecord(struct soinfo_cache *cache,
+                         const struct result_record *rec)
+{
+    if ((cache->nrecords + 1) * 4 > cache->nslots * 3) {
+        size_t nslots = cache->nslots ? 2 * cache->nslots : 256;
+        const struct result_record **slots = calloc(nslots, sizeof(*slots));
+        if (slots == NULL) {
+            return false;
+        }
+
+        const struct result_record **old = cache->slots;
+        size_t oldslots = cache->nslots;
+        cache->slots = slots;
+        cache->nslots = nslots;
+        for (size_t i = 0; i < oldslots; i++) {
+            if (old[i] != NULL) {
+                *findRecord(cache, old[i]->key.dev, old[i]->key.ino) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    const struct result_record **slot = findRecord(cache, rec->key.dev,
+                                                   rec->key.ino);
+    if (*slot != NULL) {
+        cache->dead += (*slot)->len;
+    } else {
+        cache->nrecords++;
+    }
+    *slot = rec;
+    return true;
+}
+
+
+static void resultHeader(struct result_header *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, RESULTMAGIC, sizeof(RESULTMAGIC));
+    hdr->version = RESULT_VERSION;
+    hdr->byteorder = RESULT_BYTEORDER;
+}
+
+
+static bool writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/* Create the header of an empty cache file, check the header of an
+ * existing one, and map and index its records. Called with the file
+ * locked. */
+static int readCache(struct soinfo_cache *cache, bool writable)
+{
+    struct stat st;
+    if (fstat(cache->fd, &st) == -1) {
+        return SOINFO_ERROR_OPEN;
+    }
+
+    struct result_header hdr;
+    resultHeader(&hdr);
+    if (st.st_size == 0) {
+        if (!writable) {
+            return SOINFO_SUCCESS;
+        }
+        if (!writeAll(cache->fd, &hdr, sizeof(hdr))) {
+            return SOINFO_ERROR_OPEN;
+        }
+        cache->filelen = sizeof(hdr);
+        return SOINFO_SUCCESS;
+    }
+
+    if ((uint64_t)st.st_size < sizeof(hdr)) {
+        return SOINFO_ERROR_CACHE;
+    }
+    cache->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cache->fd, 0);
+    if (cache->map == MAP_FAILED) {
+        cache->map = NULL;
+        return SOINFO_ERROR_OPEN;
+    }
+    cache->maplen = st.st_size;
+
+    if (memcmp(cache->map, &hdr, sizeof(hdr)) != 0) {
+        return SOINFO_ERROR_CACHE;
+    }
+
+    const unsigned char *base = cache->map;
+    size_t off = sizeof(hdr);
+    const struct result_record *rec;
+    while ((rec = checkRecord(base + off, cache->maplen - off)) != NULL) {
+        if (!insertRecord(cache, rec)) {
+            return SOINFO_ERROR_NOMEM;
+        }
+        off += rec->len;
+    }
+
+    /* Cut off a torn append, so that new records follow the last
+     * intact one rather than garbage. */
+    if (off < cache->maplen && writable) {
+        if (ftruncate(cache->fd, off) == -1) {
+            return SOINFO_ERROR_OPEN;
+        }
+    }
+    cache->filelen = off;
+    return SOINFO_SUCCESS;
+}
+
+
+int soinfo_cache_open(struct soinfo_cache **cache, const char *path,
+                      size_t cap)
+{
+    if (cache == NULL || path == NULL) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+    struct soinfo_cache *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return SOINFO_ERROR_NOMEM;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    c->fd = -1;
+    c->cap = cap != 0 ? cap : RESULT_CAP_DEFAULT;
+    c->path = strdup(path);
+    if (c->path == NULL) {
+        soinfo_cache_close(c);
+        return SOINFO_ERROR_NOMEM;
+    }
+
+    /* A cache we can't write to is still worth reading. */
+    bool writable = true;
+    c->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (c->fd < 0 && (errno == EACCES || errno == EROFS)) {
+        c->fd = open(path, O_RDONLY | O_CLOEXEC);
+        writable = false;
+    }
+    if (c->fd < 0) {
+        int saved = errno;
+        soinfo_cache_close(c);
+        errno = saved;
+        return SOINFO_ERROR_OPEN;
+    }
+
+    /* Keep other processes from creating the header, truncating a
+     * torn record or compacting while we read. */
+    flock(c->fd, LOCK_EX);
+    int ret = readCache(c, writable);
+    int saved = errno;
+    flock(c->fd, LOCK_UN);
+
+    if (!writable || ret != SOINFO_SUCCESS) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    if (ret != SOINFO_SUCCESS) {
+        soinfo_cache_close(c);
+        errno = saved;
+        return ret;
+    }
+
+    *cache = c;
+    return SOINFO_SUCCESS;
+}
+
+
+/* Fill in a soinfo from 'rec', pointing at the strings it holds. */
+static int infoFromRecord(const struct result_record *rec,
+                          struct soinfo_arena *arena, struct soinfo **info)
+{
+    struct soinfo *si = arenaInfo(arena, rec->ndeps);
+    if (si == NULL) {
+        return SOINFO_ERROR_NOMEM;
+    }
+    si->elfclass = rec->elfclass;
+    si->machine = rec->machine;
+    si->flags = rec->flags;
+
+    /* Skip the path. */
+    const char *s = (const char *)(rec + 1);
+    s += strlen(s) + 1;
+
+    if (rec->has_soname) {
+        si->soname = s;
+        s += strlen(s) + 1;
+    }
+    for (size_t i = 0; i < si->ndeps; i++) {
+        si->deps[i] = s;
+        s += strlen(s) + 1;
+    }
+
+    *info = si;
+    return SOINFO_SUCCESS;
+}
+
+
+/* Append a record of 'info', parsed from the file 'st' at 'path'. The
+ * cache is only an optimization, so failures are not reported; after
+ * a failed write, nothing more is appended. */
+static void addRecord(struct soinfo_cache *cache, const struct stat *st,
+                      const char *path, const struct soinfo *info)
+{
+    size_t len = sizeof(struct result_record) + strlen(path) + 1;
+    if (info->soname != NULL) {
+        len += strlen(info->soname) + 1;
+    }
+    for (size_t i = 0; i < info->ndeps; i++) {
+        len += strlen(info->deps[i]) + 1;
+    }
+    len = (len + 7) & ~(size_t)7;
+    if (len > UINT32_MAX || info->ndeps > UINT32_MAX) {
+        return;
+    }
+
+    struct result_added *added = calloc(1, sizeof(*added) + len);
+    if (added == NULL) {
+        return;
+    }
+
+    struct result_record *rec = (struct result_record *)added->rec;
+    rec->len = len;
+    makeKey(st, &rec->key);
+    rec->elfclass = info->elfclass;
+    rec->machine = info->machine;
+    rec->flags = info->flags;
+    rec->ndeps = info->ndeps;
+    rec->has_soname = info->soname != NULL;
+
+    char *p = (char *)(rec + 1);
+    p = stpcpy(p, path) + 1;
+    if (info->soname != NULL) {
+        p = stpcpy(p, info->soname) + 1;
+    }
+    for (size_t i = 0; i < info->ndeps; i++) {
+        p = stpcpy(p, info->deps[i]) + 1;
+    }
+    rec->check = recordCheck(rec);
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->fd >= 0) {
+        /* Shared with other appenders, but not with a process cutting
+         * off what it takes for a torn record. */
+        flock(cache->fd, LOCK_SH);
+        bool ok = writeAll(cache->fd, rec, len);
+        flock(cache->fd, LOCK_UN);
+        if (!ok) {
+            close(cache->fd);
+            cache->fd = -1;
+        }
+    }
+    cache->filelen += len;
+    added->next = cache->added;
+    cache->added = added;
+    insertRecord(cache, rec);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+int soinfo_cache_load(struct soinfo_cache *cache, struct soinfo **info,
+                      const char *path, int flags,
+                      struct soinfo_arena *arena)
+{
+    if (cache == NULL || info == NULL || path == NULL || arena == NULL) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        struct result_key key;
+        makeKey(&st, &key);
+
+        pthread_mutex_lock(&cache->lock);
+        const struct result_record *rec = NULL;
+        if (cache->nslots > 0) {
+            rec = *findRecord(cache, key.dev, key.ino);
+        }
+        pthread_mutex_unlock(&cache->lock);
+
+        if (rec != NULL && memcmp(&rec->key, &key, sizeof(key)) == 0) {
+            return infoFromRecord(rec, arena, info);
+        }
+    }
+
+    /* The record is keyed by the file actually parsed, in case it was
+     * replaced since the stat() above. */
+    int ret = loadFile(path, flags, arena, info, &st);
+    if (ret == SOINFO_SUCCESS) {
+        addRecord(cache, &st, path, *info);
+    }
+    return ret;
+}
+
+
+/* Whether the file 'rec' was parsed from is still there, unchanged. */
+static bool recordCurrent(const struct result_record *rec)
+{
+    struct stat st;
+    if (stat((const char *)(rec + 1), &st) == -1) {
+        return false;
+    }
+
+    struct result_key key;
+    makeKey(&st, &key);
+    return memcmp(&rec->key, &key, sizeof(key)) == 0;
+}
+
+
+/* Write the records of 'map' flagged in 'keep' to a new cache file
+ * replacing 'path'. */
+static int writeCompacted(const char *path, const unsigned char *map,
+                          const size_t *offs, const bool *keep, size_t n)
+{
+    char *tmp;
+    if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+        return SOINFO_ERROR_NOMEM;
+    }
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        int saved = errno;
+        free(tmp);
+        errno = saved;
+        return SOINFO_ERROR_OPEN;
+    }
+
+    struct result_header hdr;
+    resultHeader(&hdr);
+
+    bool ok = fchmod(fd, 0644) == 0 && writeAll(fd, &hdr, sizeof(hdr));
+    for (size_t i = 0; i < n && ok; i++) {
+        if (keep[i]) {
+            const struct result_record *rec =
+                (const struct result_record *)(map + offs[i]);
+            ok = writeAll(fd, rec, rec->len);
+        }
+    }
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+
+    int saved = errno;
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    errno = saved;
+    return ok ? SOINFO_SUCCESS : SOINFO_ERROR_OPEN;
+}
+
+
+/* Compact the file behind 'fd', which also holds whatever other
+ * processes appended since we opened it. */
+static int compactFile(struct soinfo_cache *cache, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return SOINFO_ERROR_OPEN;
+    }
+    if ((uint64_t)st.st_size <= sizeof(struct result_header)) {
+        return SOINFO_SUCCESS;
+    }
+
+    size_t len = st.st_size;
+    unsigned char *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return SOINFO_ERROR_OPEN;
+    }
+
+    /* Collect the intact records, and index the newest for each
+     * device and inode in a scratch cache. */
+    struct soinfo_cache scratch = { 0 };
+    size_t n = 0, cap = 0;
+    size_t *offs = NULL;
+    bool *keep = NULL;
+    int ret = SOINFO_SUCCESS;
+
+    const struct result_record *rec;
+    size_t off = sizeof(struct result_header);
+    while ((rec = checkRecord(map + off, len - off)) != NULL) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 256;
+            size_t *more = realloc(offs, cap * sizeof(*offs));
+            if (more == NULL) {
+                ret = SOINFO_ERROR_NOMEM;
+                break;
+            }
+            offs = more;
+        }
+        if (!insertRecord(&scratch, rec)) {
+            ret = SOINFO_ERROR_NOMEM;
+            break;
+        }
+        offs[n++] = off;
+        off += rec->len;
+    }
+
+    if (ret == SOINFO_SUCCESS) {
+        keep = malloc((n ? n : 1) * sizeof(*keep));
+        if (keep == NULL) {
+            ret = SOINFO_ERROR_NOMEM;
+        }
+    }
+
+    if (ret == SOINFO_SUCCESS) {
+        uint64_t total = sizeof(struct result_header);
+        for (size_t i = 0; i < n; i++) {
+            rec = (const struct result_record *)(map + offs[i]);
+            keep[i] = *findRecord(&scratch, rec->key.dev,
+                                  rec->key.ino) == rec &&
+                      recordCurrent(rec);
+            if (keep[i]) {
+                total += rec->len;
+            }
+        }
+
+        /* Still too big: drop the oldest records, leaving room to grow
+         * before the next compaction. */
+        if (total > cache->cap) {
+            for (size_t i = 0; i < n && total > cache->cap / 2; i++) {
+                if (keep[i]) {
+                    keep[i] = false;
+                    total -= ((const struct result_record *)
+                              (map + offs[i]))->len;
+                }
+            }
+        }
+
+        ret = writeCompacted(cache->path, map, offs, keep, n);
+        if (ret == SOINFO_SUCCESS) {
+            cache->filelen = total;
+            cache->dead = 0;
+        }
+    }
+
+    int saved = errno;
+    free(scratch.slots);
+    free(offs);
+    free(keep);
+    munmap(map, len);
+    errno = saved;
+    return ret;
+}
+
+
+int soinfo_cache_compact(struct soinfo_cache *cache)
+{
+    if (cache == NULL) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->fd < 0) {
+        pthread_mutex_unlock(&cache->lock);
+        errno = EBADF;
+        return SOINFO_ERROR_OPEN;
+    }
+
+    flock(cache->fd, LOCK_EX);
+    int ret = compactFile(cache, cache->fd);
+    int saved = errno;
+
+    /* Further records go to the new file. What this cache returned
+     * stays valid, since the old file remains mapped. */
+    if (ret == SOINFO_SUCCESS) {
+        int fd = open(cache->path, O_RDWR | O_APPEND | O_CLOEXEC);
+        saved = errno;
+        close(cache->fd);
+        cache->fd = fd;
+        if (fd < 0) {
+            ret = SOINFO_ERROR_OPEN;
+        }
+    } else {
+        flock(cache->fd, LOCK_UN);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    errno = saved;
+    return ret;
+}
+
+
+void soinfo_cache_close(struct soinfo_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    if (cache->fd >= 0 && (cache->filelen > cache->cap ||
+                           cache->dead > cache->filelen / 2)) {
+        soinfo_cache_compact(cache);
+    }
+
+    if (cache->fd >= 0) {
+        close(cache->fd);
+    }
+    if (cache->map != NULL) {
+        munmap(cache->map, cache->maplen);
+    }
+    while (cache->added != NULL) {
+        struct result_added *next = cache->added->next;
+        free(cache->added);
+        cache->added = next;
+    }
+    free(cache->slots);
+    free(cache->path);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+
+/* A batch keeps up to 'depth' loads in flight, each in a slot with its
+ * own arena. A slot is held from soinfo_batch_add() until the call to
+ * soinfo_batch_next() after the one that returned its result, so there
+ * is one slot more than the depth.
+ *
+ * With io_uring, a load is driven by its completions: an OPENAT of the
+ * path, then a STATX of the file it opened, then the parser is run,
+ * each range it asks for is queued as a READ, and the file is closed
+ * with a CLOSE. The STATX is of the descriptor rather than the path,
+ * as ldconfig and package managers replace libraries by rename(), and
+ * a file replaced between the two would have the parse bounded by
+ * the size of another file. Requests are only submitted when a
+ * result is waited for, so a full batch costs one system call to
+ * submit and reads for different files overlap. The ring is set up
+ * with raw system calls, as it needs only a handful of opcodes; if
+ * that fails (io_uring is often disabled in containers) or the kernel
+ * lacks one of them (before 5.6), each file is instead loaded with
+ * loadFile() as it is added. */
+
+#ifdef SOINFO_URING
+
+/* The first read of a file, which takes in the program headers along
+ * with the ELF header in all but odd objects. */
+#define BATCH_HEAD 4096
+
+/* The most read at once, as an SQE's length is 32 bits. */
+#define BATCH_READMAX (1U << 30)
+
+/* user_data is the slot index shifted left by 8, ORed with the op. */
+enum batch_op {
+    BATCH_OPEN,
+    BATCH_STATX,
+    BATCH_READ,
+    BATCH_CLOSE,
+};
+
+#endif /* SOINFO_URING */
+
+struct batch_slot
+{
+  struct batch_slot *next; /* In the free or done list. */
+  struct soinfo_arena arena;
+  bool held;
+
+  void *data;
+  int error;
+  int errnum;
+  struct soinfo *info;
+
+#ifdef SOINFO_URING
+  unsigned inflight; /* Requests queued and not completed. */
+  int fd;
+  struct statx stx;
+
+  struct elf_parse parse;
+  uint64_t nread;
+
+  /* The read in flight, of 'len' bytes at 'off', 'got' done so far. */
+  unsigned char *buf;
+  uint64_t off;
+  size_t len;
+  size_t got;
+#endif
+};
+
+struct soinfo_batch
+{
+  int flags;
+  unsigned depth;
+  unsigned pending; /* Loads added whose result wasn't returned yet. */
+
+  struct batch_slot *slots;
+  struct batch_slot *free;
+  struct batch_slot *done;
+  struct batch_slot **donetail;
+  struct batch_slot *returned; /* The slot of the last result. */
+
+#ifdef SOINFO_URING
+  int ring; /* Or -1 without io_uring. */
+  unsigned inflight;
+  unsigned tosubmit;
+
+  void *sqmap;
+  size_t sqmaplen;
+  void *cqmap;
+  size_t cqmaplen;
+  struct io_uring_sqe *sqes;
+  size_t sqeslen;
+
+  unsigned sqentries;
+  unsigned *sqhead;
+  unsigned *sqtail;
+  unsigned *sqmask;
+  unsigned *sqarray;
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned *cqmask;
+  struct io_uring_cqe *cqes;
+#endif
+};
+
+
+static void pushDone(struct soinfo_batch *batch, struct batch_slot *s)
+{
+    s->next = NULL;
+    *batch->donetail = s;
+    batch->donetail = &s->next;
+}
+
+
+#ifdef SOINFO_URING
+
+static void ringTeardown(struct soinfo_batch *batch)
+{
+    if (batch->sqes != NULL) {
+        munmap(batch->sqes, batch->sqeslen);
+    }
+    if (batch->cqmap != NULL && batch->cqmap != batch->sqmap) {
+        munmap(batch->cqmap, batch->cqmaplen);
+    }
+    if (batch->sqmap != NULL) {
+        munmap(batch->sqmap, batch->sqmaplen);
+    }
+    if (batch->ring >= 0) {
+        close(batch->ring);
+    }
+    batch->sqes = NULL;
+    batch->sqmap = batch->cqmap = NULL;
+    batch->ring = -1;
+}
+
+
+/* Check the kernel supports every opcode the batch uses. */
+static bool ringProbe(int ring)
+{
+    static const unsigned char ops[] = {
+        IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE,
+    };
+
+    struct io_uring_probe *probe =
+        calloc(1, sizeof(*probe) + 256 * sizeof(probe->ops[0]));
+    if (probe == NULL) {
+        return false;
+    }
+
+    bool ok = syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE,
+                      probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(ops); i++) {
+        ok = ops[i] <= probe->last_op &&
+             (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+
+/* Set up a ring of at least 'entries' entries, returning false if
+ * io_uring can't be used. */
+static bool ringSetup(struct soinfo_batch *batch, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    batch->ring = syscall(__NR_io_uring_setup, entries, &params);
+    if (batch->ring < 0) {
+        batch->ring = -1;
+        return false;
+    }
+    if (!ringProbe(batch->ring)) {
+        ringTeardown(batch);
+        return false;
+    }
+
+    batch->sqmaplen = params.sq_off.array +
+                      params.sq_entries * sizeof(unsigned);
+    batch->cqmaplen = params.cq_off.cqes +
+                      params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (batch->cqmaplen > batch->sqmaplen) {
+            batch->sqmaplen = batch->cqmaplen;
+        }
+        batch->cqmaplen = batch->sqmaplen;
+    }
+
+    void *sq = mmap(NULL, batch->sqmaplen, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, batch->ring,
+                    IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        ringTeardown(batch);
+        return false;
+    }
+    batch->sqmap = sq;
+
+    void *cq = sq;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, batch->cqmaplen, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, batch->ring, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            ringTeardown(batch);
+            return false;
+        }
+    }
+    batch->cqmap = cq;
+
+    batch->sqeslen = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, batch->sqeslen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, batch->ring,
+                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        ringTeardown(batch);
+        return false;
+    }
+    batch->sqes = sqes;
+
+    unsigned char *sqp = sq, *cqp = cq;
+    batch->sqentries = params.sq_entries;
+    batch->sqhead = (unsigned *)(sqp + params.sq_off.head);
+    batch->sqtail = (unsigned *)(sqp + params.sq_off.tail);
+    batch->sqmask = (unsigned *)(sqp + params.sq_off.ring_mask);
+    batch->sqarray = (unsigned *)(sqp + params.sq_off.array);
+    batch->cqhead = (unsigned *)(cqp + params.cq_off.head);
+    batch->cqtail = (unsigned *)(cqp + params.cq_off.tail);
+    batch->cqmask = (unsigned *)(cqp + params.cq_off.ring_mask);
+    batch->cqes = (struct io_uring_cqe *)(cqp + params.cq_off.cqes);
+    return true;
+}
+
+
+/* Submit what has been queued and wait for 'wait' completions. */
+static int ringEnter(struct soinfo_batch *batch, unsigned wait)
+{
+    for (;;) {
+        int n = syscall(__NR_io_uring_enter, batch->ring, batch->tosubmit,
+                        wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0,
+                        NULL, 0);
+        if (n >= 0) {
+            batch->tosubmit -= n;
+            return SOINFO_SUCCESS;
+        }
+        if (errno != EINTR && errno != EAGAIN) {
+            return SOINFO_ERROR_OPEN;
+        }
+    }
+}
+
+
+/* Queue a request for slot 's', returning its zeroed SQE. The ring has
+ * room for two requests for every slot, more than a slot ever has in
+ * flight. */
+static struct io_uring_sqe *queueSqe(struct soinfo_batch *batch,
+                                     struct batch_slot *s, enum batch_op op)
+{
+    unsigned tail = *batch->sqtail;
+    unsigned index = tail & *batch->sqmask;
+    struct io_uring_sqe *sqe = &batch->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)(s - batch->slots) << 8 | op;
+    batch->sqarray[index] = index;
+    __atomic_store_n(batch->sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    batch->tosubmit++;
+    batch->inflight++;
+    s->inflight++;
+    return sqe;
+}
+
+
+/* Finish the load in slot 's', closing its file. */
+static void finishLoad(struct soinfo_batch *batch, struct batch_slot *s,
+                       int error, int errnum)
+{
+    s->error = error;
+    s->errnum = errnum;
+    if (s->fd >= 0) {
+        struct io_uring_sqe *sqe = queueSqe(batch, s, BATCH_CLOSE);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = s->fd;
+    }
+    pushDone(batch, s);
+}
+
+
+static void queueRead(struct soinfo_batch *batch, struct batch_slot *s)
+{
+    size_t len = s->len - s->got;
+    struct io_uring_sqe *sqe = queueSqe(batch, s, BATCH_READ);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)(s->buf + s->got);
+    sqe->len = len < BATCH_READMAX ? len : BATCH_READMAX;
+    sqe->off = s->off + s->got;
+}
+
+
+/* Run the parser of slot 's' until it needs another range, and queue
+ * the read of it. */
+static void advanceLoad(struct soinfo_batch *batch, struct batch_slot *s)
+{
+    struct elf_parse *p = &s->parse;
+    int ret = parseStep(p);
+    if (ret != PARSE_MORE) {
+        if (ret == SOINFO_SUCCESS) {
+            p->si->nread = s->nread;
+            s->info = p->si;
+        }
+        finishLoad(batch, s, ret, 0);
+        return;
+    }
+
+    s->off = p->off;
+    s->len = p->want;
+    if (p->state == PARSE_EHDR) {
+        s->len = p->f.len < BATCH_HEAD ? p->f.len : BATCH_HEAD;
+    }
+    s->got = 0;
+    s->buf = arenaAlloc(&s->arena, s->len);
+    if (s->buf == NULL) {
+        finishLoad(batch, s, SOINFO_ERROR_NOMEM, 0);
+        return;
+    }
+    queueRead(batch, s);
+}
+
+
+/* Queue the STATX of the file slot 's' has opened, the equivalent of
+ * fstat(). */
+static void queueStatx(struct soinfo_batch *batch, struct batch_slot *s)
+{
+    struct io_uring_sqe *sqe = queueSqe(batch, s, BATCH_STATX);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)"";
+    sqe->statx_flags = AT_EMPTY_PATH;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (uintptr_t)&s->stx;
+}
+
+
+/* The STATX of the file of slot 's' is done. */
+static void startLoad(struct soinfo_batch *batch, struct batch_slot *s)
+{
+    /* As in loadNative(). */
+    if (!S_ISREG(s->stx.stx_mode) || s->stx.stx_size < EI_NIDENT) {
+        finishLoad(batch, s, SOINFO_ERROR_ELF, 0);
+        return;
+    }
+
+    parseInit(&s->parse, s->stx.stx_size, &s->arena);
+    advanceLoad(batch, s);
+}
+
+
+static void readDone(struct soinfo_batch *batch, struct batch_slot *s,
+                     int res)
+{
+    if (res == -EINTR || res == -EAGAIN) {
+        queueRead(batch, s);
+        return;
+    }
+    if (res < 0) {
+        finishLoad(batch, s, SOINFO_ERROR_OPEN, -res);
+        return;
+    }
+    if (res == 0) {
+        /* The file was truncated under us. */
+        finishLoad(batch, s, SOINFO_ERROR_FORMAT, 0);
+        return;
+    }
+
+    s->got += res;
+    if (s->got < s->len) {
+        queueRead(batch, s);
+        return;
+    }
+    s->nread += s->len;
+    parseGive(&s->parse, s->off, s->buf, s->len);
+    advanceLoad(batch, s);
+}
+
+
+/* Handle every completion posted so far. */
+static void reapCompletions(struct soinfo_batch *batch)
+{
+    unsigned head = *batch->cqhead;
+    unsigned tail = __atomic_load_n(batch->cqtail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &batch->cqes[head & *batch->cqmask];
+        struct batch_slot *s = &batch->slots[cqe->user_data >> 8];
+        enum batch_op op = cqe->user_data & 0xff;
+        int res = cqe->res;
+        __atomic_store_n(batch->cqhead, head + 1, __ATOMIC_RELEASE);
+
+        batch->inflight--;
+        s->inflight--;
+        switch (op) {
+            case BATCH_OPEN:
+                if (res < 0) {
+                    finishLoad(batch, s, SOINFO_ERROR_OPEN, -res);
+                } else {
+                    s->fd = res;
+                    queueStatx(batch, s);
+                }
+                continue;
+            case BATCH_STATX:
+                if (res < 0) {
+                    finishLoad(batch, s, SOINFO_ERROR_OPEN, -res);
+                } else {
+                    startLoad(batch, s);
+                }
+                continue;
+            case BATCH_READ:
+                readDone(batch, s, res);
+                continue;
+            case BATCH_CLOSE:
+                s->fd = -1;
+                if (!s->held && s->inflight == 0) {
+                    s->next = batch->free;
+                    batch->free = s;
+                }
+                continue;
+        }
+    }
+}
+
+
+/* Queue the OPENAT of 'path' for slot 's'. */
+static void queueOpen(struct soinfo_batch *batch, struct batch_slot *s,
+                      const char *path)
+{
+    s->fd = -1;
+    s->nread = 0;
+
+    struct io_uring_sqe *sqe = queueSqe(batch, s, BATCH_OPEN);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+#endif /* SOINFO_URING */
+
+
+int soinfo_batch_open(struct soinfo_batch **batch, unsigned depth, int flags)
+{
+    if (batch == NULL || depth == 0 || depth > SOINFO_BATCH_MAX) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+    struct soinfo_batch *b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        return SOINFO_ERROR_NOMEM;
+    }
+    b->slots = calloc(depth + 1, sizeof(*b->slots));
+    if (b->slots == NULL) {
+        free(b);
+        return SOINFO_ERROR_NOMEM;
+    }
+    b->flags = flags;
+    b->depth = depth;
+    b->donetail = &b->done;
+    for (unsigned i = depth + 1; i-- > 0;) {
+        soinfo_arena_init(&b->slots[i].arena);
+        b->slots[i].next = b->free;
+        b->free = &b->slots[i];
+    }
+
+#ifdef SOINFO_URING
+    b->ring = -1;
+    if (!(flags & SOINFO_SYNC)) {
+        ringSetup(b, 2 * (depth + 1));
+    }
+#endif
+
+    *batch = b;
+    return SOINFO_SUCCESS;
+}
+
+
+int soinfo_batch_add(struct soinfo_batch *batch, const char *path, void *data)
+{
+    if (batch == NULL || path == NULL || batch->pending == batch->depth) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+#ifdef SOINFO_URING
+    /* Slots whose result was returned may still be closing their
+     * file. */
+    while (batch->free == NULL) {
+        int ret = ringEnter(batch, 1);
+        if (ret != SOINFO_SUCCESS) {
+            return ret;
+        }
+        reapCompletions(batch);
+    }
+#endif
+
+    struct batch_slot *s = batch->free;
+    batch->free = s->next;
+    s->held = true;
+    s->data = data;
+    s->info = NULL;
+    batch->pending++;
+
+#ifdef SOINFO_URING
+    if (batch->ring >= 0) {
+        /* The path must outlive the requests, which are only
+         * submitted later. */
+        const char *copy = arenaString(&s->arena, path, strlen(path));
+        if (copy == NULL) {
+            s->error = SOINFO_ERROR_NOMEM;
+            s->errnum = 0;
+            pushDone(batch, s);
+        } else {
+            queueOpen(batch, s, copy);
+        }
+        return SOINFO_SUCCESS;
+    }
+#endif
+
+    struct stat st;
+    s->error = loadFile(path, batch->flags, &s->arena, &s->info, &st);
+    s->errnum = s->error == SOINFO_ERROR_OPEN ? errno : 0;
+    pushDone(batch, s);
+    return SOINFO_SUCCESS;
+}
+
+
+/* Give back the slot of the result returned last. */
+static void releaseSlot(struct soinfo_batch *batch)
+{
+    struct batch_slot *s = batch->returned;
+    if (s == NULL) {
+        return;
+    }
+    batch->returned = NULL;
+    soinfo_arena_reset(&s->arena);
+    s->held = false;
+
+#ifdef SOINFO_URING
+    if (s->inflight > 0) {
+        /* Freed once its CLOSE completes. */
+        return;
+    }
+#endif
+    s->next = batch->free;
+    batch->free = s;
+}
+
+
+int soinfo_batch_next(struct soinfo_batch *batch, struct soinfo_result *res)
+{
+    if (batch == NULL || res == NULL) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+    releaseSlot(batch);
+    if (batch->pending == 0) {
+        return SOINFO_ERROR_INVAL;
+    }
+
+#ifdef SOINFO_URING
+    while (batch->done == NULL) {
+        int ret = ringEnter(batch, 1);
+        if (ret != SOINFO_SUCCESS) {
+            return ret;
+        }
+        reapCompletions(batch);
+    }
+#endif
+
+    struct batch_slot *s = batch->done;
+    batch->done = s->next;
+    if (batch->done == NULL) {
+        batch->donetail = &batch->done;
+    }
+    batch->pending--;
+    batch->returned = s;
+
+    res->data = s->data;
+    res->error = s->error;
+    res->errnum = s->errnum;
+    res->info = s->error == SOINFO_SUCCESS ? s->info : NULL;
+    return SOINFO_SUCCESS;
+}
+
+
+void soinfo_batch_close(struct soinfo_batch *batch)
+{
+    if (batch == NULL) {
+        return;
+    }
+
+#ifdef SOINFO_URING
+    /* Let the loads still in flight finish, so that nothing is read
+     * into their arenas once they are freed and no file is left
+     * open. */
+    while (batch->ring >= 0 && batch->inflight > 0 &&
+           ringEnter(batch, 1) == SOINFO_SUCCESS) {
+        reapCompletions(batch);
+    }
+    ringTeardown(batch);
+#endif
+
+    for (unsigned i = 0; i <= batch->depth; i++) {
+        soinfo_arena_free(&batch->slots[i].arena);
+    }
+    free(batch->slots);
+    free(batch);
+}
+
+
+const char *soinfo_strerror(int error)
+{
+    switch (error) {
+        case SOINFO_SUCCESS:
+            return "success";
+        case SOINFO_ERROR_INVAL:
+            return "invalid argument";
+        case SOINFO_ERROR_OPEN:
+            return "unable to open file";
+        case SOINFO_ERROR_ELF:
+            return "not an ELF object";
+        case SOINFO_ERROR_NOMEM:
+            return "out of memory";
+        case SOINFO_ERROR_FORMAT:
+            return "malformed ELF object";
+        case SOINFO_ERROR_NODYN:
+            return "no dynamic section";
+        case SOINFO_ERROR_CACHE:
+            return "not a soinfo result cache";
+    }
+    return "unknown error";
+}
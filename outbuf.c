@@ -0,0 +1,241 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+
+int outbuf_init(struct outbuf *out, int fd, size_t cap)
+{
+    if (cap == 0) {
+        cap = OUTBUF_DEFAULT_SIZE;
+    }
+
+    out->buf = malloc(cap);
+    if (out->buf == NULL) {
+        return -1;
+    }
+    out->fd = fd;
+    out->error = 0;
+    out->len = 0;
+    out->cap = cap;
+    return 0;
+}
+
+
+void outbuf_free(struct outbuf *out)
+{
+    free(out->buf);
+    out->buf = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
+
+
+static void writeAll(struct outbuf *out, const char *data, size_t len)
+{
+    while (len > 0 && out->error == 0) {
+        ssize_t n = write(out->fd, data, len);
+        if (n < 0) {
+            if (errno != EINTR) {
+                out->error = errno;
+            }
+            continue;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+
+int outbuf_flush(struct outbuf *out)
+{
+    if (out->fd >= 0) {
+        writeAll(out, out->buf, out->len);
+        out->len = 0;
+    }
+
+    if (out->error != 0) {
+        errno = out->error;
+        return -1;
+    }
+    return 0;
+}
+
+
+void outbuf_write_slow(struct outbuf *out, const void *data, size_t len)
+{
+    if (out->error != 0) {
+        return;
+    }
+
+    /* In-memory sinks grow to hold everything. */
+    if (out->fd < 0) {
+        size_t cap = out->cap ? out->cap : OUTBUF_DEFAULT_SIZE;
+        while (cap - out->len < len) {
+            cap *= 2;
+        }
+
+        char *buf = realloc(out->buf, cap);
+        if (buf == NULL) {
+            out->error = ENOMEM;
+            return;
+        }
+        out->buf = buf;
+        out->cap = cap;
+        memcpy(out->buf + out->len, data, len);
+        out->len += len;
+        return;
+    }
+
+    outbuf_flush(out);
+
+    /* Anything that won't fit even in an empty buffer bypasses it. */
+    if (len > out->cap) {
+        writeAll(out, data, len);
+        return;
+    }
+    memcpy(out->buf, data, len);
+    out->len = len;
+}
+
+
+void outbuf_u64(struct outbuf *out, uint64_t value)
+{
+    char digits[20];
+    int n = sizeof(digits);
+
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    outbuf_write(out, digits + n, sizeof(digits) - n);
+}
+
+
+void outbuf_i64(struct outbuf *out, int64_t value)
+{
+    if (value < 0) {
+        outbuf_char(out, '-');
+        outbuf_u64(out, -(uint64_t)value);
+        return;
+    }
+    outbuf_u64(out, value);
+}
+
+
+void outbuf_hex(struct outbuf *out, uint64_t value, int width)
+{
+    static const char xdigits[] = "0123456789abcdef";
+    char digits[16];
+    int n = sizeof(digits);
+
+    if (width > (int)sizeof(digits)) {
+        width = sizeof(digits);
+    }
+
+    do {
+        digits[--n] = xdigits[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+
+    while ((int)sizeof(digits) - n < width) {
+        digits[--n] = '0';
+    }
+
+    outbuf_write(out, digits + n, sizeof(digits) - n);
+}
+
+
+/* Return the length of the UTF-8 sequence starting with the byte
+ * 'p[0]' >= 0x80, or 0 if it is not a valid one. Overlong forms,
+ * surrogates and code points above U+10FFFF are invalid, as RFC 3629
+ * has it. The NUL terminator fails every check, so no byte after it is
+ * read. */
+static size_t utf8Len(const unsigned char *p)
+{
+    unsigned char lo = 0x80; /* Range allowed for the second byte. */
+    unsigned char hi = 0xbf;
+    size_t len;
+
+    if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+        len = 2;
+    } else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+        len = 3;
+        if (p[0] == 0xe0) {
+            lo = 0xa0;
+        } else if (p[0] == 0xed) {
+            hi = 0x9f;
+        }
+    } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+        len = 4;
+        if (p[0] == 0xf0) {
+            lo = 0x90;
+        } else if (p[0] == 0xf4) {
+            hi = 0x8f;
+        }
+    } else {
+        return 0;
+    }
+
+    if (p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < len; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+
+void outbuf_json_str(struct outbuf *out, const char *str)
+{
+    static const char xdigits[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)str;
+
+    outbuf_char(out, '"');
+    for (;;) {
+        /* Copy runs of bytes that need no escaping in one go. */
+        const unsigned char *run = p;
+        size_t n;
+        for (;;) {
+            if (*p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\') {
+                p++;
+            } else if (*p >= 0x80 && (n = utf8Len(p)) > 0) {
+                p += n;
+            } else {
+                break;
+            }
+        }
+        outbuf_write(out, run, p - run);
+
+        if (*p == '\0') {
+            break;
+        }
+
+        char esc[6] = { '\\' };
+        size_t len = 2;
+        switch (*p) {
+            case '"':  esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = xdigits[*p >> 4];
+                esc[5] = xdigits[*p & 0xf];
+                len = 6;
+                break;
+        }
+        outbuf_write(out, esc, len);
+        p++;
+    }
+    outbuf_char(out, '"');
+}
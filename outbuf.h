@@ -0,0 +1,96 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OUTBUF_DEFAULT_SIZE (256 * 1024)
+
+/* A minimal buffered output sink shared by the command line tools.
+ * Output is collected in one large buffer and handed to the kernel
+ * with a single write() per flush, instead of going through stdio's
+ * locking and format string parsing for every field.
+ *
+ * A sink created with an fd of -1 never flushes. Its buffer simply
+ * grows, which is used to format a block of output in memory before
+ * appending it to another sink in one go.
+ *
+ * Write errors are sticky: once a write fails, further output is
+ * discarded and 'error' holds the errno of the failure. */
+struct outbuf
+{
+  int fd;
+  int error;
+  char *buf;
+  size_t len;
+  size_t cap;
+};
+
+/* Initialize 'out' to write to 'fd' through a buffer of 'cap' bytes
+ * (OUTBUF_DEFAULT_SIZE if 0). Returns -1 if allocation fails. */
+int outbuf_init(struct outbuf *out, int fd, size_t cap);
+
+/* Release the buffer, without flushing it. */
+void outbuf_free(struct outbuf *out);
+
+/* Write out everything buffered so far. Returns -1 (with errno set) if
+ * this or any earlier write failed. */
+int outbuf_flush(struct outbuf *out);
+
+void outbuf_write_slow(struct outbuf *out, const void *data, size_t len);
+
+static inline void outbuf_write(struct outbuf *out, const void *data,
+                                size_t len)
+{
+    if (len <= out->cap - out->len) {
+        memcpy(out->buf + out->len, data, len);
+        out->len += len;
+        return;
+    }
+    outbuf_write_slow(out, data, len);
+}
+
+static inline void outbuf_str(struct outbuf *out, const char *str)
+{
+    outbuf_write(out, str, strlen(str));
+}
+
+static inline void outbuf_char(struct outbuf *out, char c)
+{
+    if (out->len < out->cap) {
+        out->buf[out->len++] = c;
+        return;
+    }
+    outbuf_write_slow(out, &c, 1);
+}
+
+/* Format integers without going through printf(). outbuf_hex() writes
+ * lowercase digits with no prefix, at least 'width' of them. */
+void outbuf_u64(struct outbuf *out, uint64_t value);
+void outbuf_i64(struct outbuf *out, int64_t value);
+void outbuf_hex(struct outbuf *out, uint64_t value, int width);
+
+/* Write 'str' as a quoted JSON string. Quotes, backslashes and control
+ * characters are escaped as it is copied, so no escaped copy of the
+ * string is ever built. Valid UTF-8 is copied as is. Paths and sonames
+ * are arbitrary bytes though, so any byte that is not part of a valid
+ * UTF-8 sequence is escaped as "\u00XX", keeping the output valid
+ * JSON. */
+void outbuf_json_str(struct outbuf *out, const char *str);
+
+/* Write '"key":' for the object member 'key', preceded by a comma
+ * unless it is the first member. 'key' is written as is and must not
+ * need escaping. */
+static inline void outbuf_json_key(struct outbuf *out, const char *key,
+                                   int first)
+{
+    if (!first) {
+        outbuf_char(out, ',');
+    }
+    outbuf_char(out, '"');
+    outbuf_str(out, key);
+    outbuf_write(out, "\":", 2);
+}
+
+#endif /* OUTBUF_H */
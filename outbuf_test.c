@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "outbuf.h"
+
+/* outbuf_test checks the formatting helpers of outbuf.c against known
+ * output. It prints each failed check and exits non-zero if there
+ * were any. */
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            failures++; \
+        } \
+    } while (0)
+
+
+/* Check that outbuf_json_str() writes 'str' as 'want'. The sink starts
+ * out tiny, so that escapes and runs also straddle the buffer
+ * growing. */
+static void checkJson(const char *what, const char *str, const char *want)
+{
+    struct outbuf out;
+    if (outbuf_init(&out, -1, 4) == -1) {
+        abort();
+    }
+
+    outbuf_json_str(&out, str);
+    CHECK(out.len == strlen(want) && memcmp(out.buf, want, out.len) == 0,
+          "%s: got '%.*s', expected '%s'", what, (int)out.len, out.buf,
+          want);
+    outbuf_free(&out);
+}
+
+
+static void testJsonStr(void)
+{
+    checkJson("empty", "", "\"\"");
+    checkJson("plain", "libc.so.6", "\"libc.so.6\"");
+    checkJson("quotes and backslashes", "a\"b\\c\"",
+              "\"a\\\"b\\\\c\\\"\"");
+    checkJson("short escapes", "\b\f\n\r\t", "\"\\b\\f\\n\\r\\t\"");
+    checkJson("other control characters", "\x01x\x1f\x1b",
+              "\"\\u0001x\\u001f\\u001b\"");
+    checkJson("DEL needs no escape", "\x7f", "\"\x7f\"");
+
+    /* Valid UTF-8 of every length is copied as is, including the
+     * smallest and largest code point of each length. */
+    checkJson("2 byte UTF-8", "\xc2\x80 caf\xc3\xa9 \xdf\xbf",
+              "\"\xc2\x80 caf\xc3\xa9 \xdf\xbf\"");
+    checkJson("3 byte UTF-8",
+              "\xe0\xa0\x80\xe2\x82\xac\xed\x9f\xbf\xef\xbf\xbf",
+              "\"\xe0\xa0\x80\xe2\x82\xac\xed\x9f\xbf\xef\xbf\xbf\"");
+    checkJson("4 byte UTF-8", "\xf0\x90\x80\x80\xf4\x8f\xbf\xbf",
+              "\"\xf0\x90\x80\x80\xf4\x8f\xbf\xbf\"");
+
+    /* Anything else is escaped a byte at a time, and whatever follows
+     * a bad byte is judged on its own. */
+    checkJson("Latin-1", "caf\xe9", "\"caf\\u00e9\"");
+    checkJson("lone continuation byte", "\x80x", "\"\\u0080x\"");
+    checkJson("overlong 2 byte form", "\xc0\xaf", "\"\\u00c0\\u00af\"");
+    checkJson("overlong 3 byte form", "\xe0\x80\xaf",
+              "\"\\u00e0\\u0080\\u00af\"");
+    checkJson("overlong 4 byte form", "\xf0\x80\x80\xaf",
+              "\"\\u00f0\\u0080\\u0080\\u00af\"");
+    checkJson("surrogate", "\xed\xa0\x80",
+              "\"\\u00ed\\u00a0\\u0080\"");
+    checkJson("above U+10FFFF", "\xf4\x90\x80\x80",
+              "\"\\u00f4\\u0090\\u0080\\u0080\"");
+    checkJson("invalid lead bytes", "\xf5\xff", "\"\\u00f5\\u00ff\"");
+    checkJson("sequence cut short by another",
+              "\xe2\x82\xc3\xa9", "\"\\u00e2\\u0082\xc3\xa9\"");
+    checkJson("sequence cut short by the end", "x\xe2\x82",
+              "\"x\\u00e2\\u0082\"");
+    checkJson("sequence cut short by a quote", "\xc3\"",
+              "\"\\u00c3\\\"\"");
+}
+
+
+int main(void)
+{
+    testJsonStr();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
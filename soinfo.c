@@ -1,122 +1,613 @@
+#define _GNU_SOURCE
+#include <dirent.h>
 #include <err.h>
-#include <fcntl.h>
-#include <gelf.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-int main(int argc, char **argv)
+#include "outbuf.h"
+#include "soinfo.h"
+
+/* soinfo prints the soname and DT_NEEDED entries of ELF objects. Any
+ * number of files can be given, along with directories (which are
+ * walked recursively, in sorted order) and '@list' files naming one
+ * path per line ('@-' reads the list from stdin).
+ *
+ * Files are parsed on a pool of worker threads. Each result is
+ * formatted into its own buffer, and the buffers are written out in
+ * input order, so the output does not depend on scheduling. At most
+ * 'window' files are in flight (queued, being parsed, or waiting for
+ * an earlier file to be written) at any time, which bounds memory use
+ * however many files are scanned.
+ *
+ * Each worker loads its files into its own arena, reset after every
+ * file, so that a scan allocates little beyond the output buffers. -s
+ * reports the arena's peak usage when done.
+ *
+ * With -p, files are read with pread() rather than mapped, fetching
+ * only the parts needed, and the number of bytes read is reported for
+ * each file.
+ *
+ * With -c, results are looked up in and added to a persistent cache
+ * file, so that unchanged files are not parsed again by later scans.
+ *
+ * With -u, each worker loads up to 'depth' files at once through a
+ * soinfo_batch, which queues their reads on an io_uring where the
+ * kernel allows, so that a few threads keep many reads outstanding on
+ * slow or cold storage. */
+
+struct options
+{
+  bool json;
+  bool batch; /* Label each file's text output with its path. */
+  bool stats;
+  int flags;  /* For soinfo_load(). */
+  struct soinfo_cache *cache;
+  unsigned depth; /* With -u, the files each worker loads at once. */
+};
+
+/* A file to parse. 'quiet' is set for files found by walking a
+ * directory, which are skipped without a warning if they turn out not
+ * to be dynamic ELF objects, since directories hold all sorts. */
+struct job
 {
-    if (argc != 2) {
-        errx(EXIT_FAILURE, "usage: %s file-name", argv[0]);
+  char *path;
+  bool quiet;
+  bool done;
+  bool failed;
+  struct outbuf out;
+  char msg[256];
+};
+
+struct pool
+{
+  const struct options *opts;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  struct job *ring; /* Job n lives in ring[n % window]. */
+  size_t window;
+  size_t produced;  /* Jobs queued so far. */
+  size_t taken;     /* Jobs claimed by a worker. */
+  size_t written;   /* Jobs whose output has been written. */
+  bool finished;    /* No more jobs will be queued. */
+
+  struct outbuf *out;
+  bool failed;
+  size_t peak; /* The largest arena peak of any worker. */
+};
+
+void printInfo(struct outbuf *out, const struct options *opts,
+               const char *path, const struct soinfo *info)
+{
+    if (opts->json) {
+        /* One object per line, so that many files can be streamed. */
+        outbuf_char(out, '{');
+        outbuf_json_key(out, "file", true);
+        outbuf_json_str(out, path);
+        outbuf_json_key(out, "soname", false);
+        if (info->soname != NULL) {
+            outbuf_json_str(out, info->soname);
+        } else {
+            outbuf_str(out, "null");
+        }
+        outbuf_json_key(out, "needed", false);
+        outbuf_char(out, '[');
+        for (size_t i = 0; i < info->ndeps; i++) {
+            if (i > 0) {
+                outbuf_char(out, ',');
+            }
+            outbuf_json_str(out, info->deps[i]);
+        }
+        outbuf_char(out, ']');
+        if (opts->flags & SOINFO_PREAD) {
+            outbuf_json_key(out, "bytes_read", false);
+            outbuf_u64(out, info->nread);
+        }
+        outbuf_write(out, "}\n", 2);
+        return;
     }
 
-    if (elf_version(EV_CURRENT) == EV_NONE) {
-        errx(EXIT_FAILURE, "ELF library initialization "
-            "failed: %s", elf_errmsg(-1));
+    if (opts->batch) {
+        outbuf_str(out, "file: ");
+        outbuf_str(out, path);
+        outbuf_char(out, '\n');
+    }
+    /* Executables usually have no soname. */
+    if (info->soname != NULL) {
+        outbuf_str(out, "soname: ");
+        outbuf_str(out, info->soname);
+        outbuf_char(out, '\n');
+    }
+    for (size_t i = 0; i < info->ndeps; i++) {
+        outbuf_str(out, "dep[");
+        outbuf_u64(out, i);
+        outbuf_str(out, "]: ");
+        outbuf_str(out, info->deps[i]);
+        outbuf_char(out, '\n');
+    }
+    if (opts->flags & SOINFO_PREAD) {
+        outbuf_str(out, "bytes-read: ");
+        outbuf_u64(out, info->nread);
+        outbuf_char(out, '\n');
     }
+}
+
 
-    int fd = open(argv[1], O_RDONLY);
-    if (fd < 0) {
-        err(EXIT_FAILURE, "open '%s' failed", argv[1]);
+/* Format the result of loading the file of 'job' into its buffer, or
+ * an error message into 'msg'. 'errnum' is the errno of a failed
+ * open. */
+void finishJob(const struct options *opts, struct job *job, int ret,
+               int errnum, const struct soinfo *info)
+{
+    if (ret != SOINFO_SUCCESS) {
+        if (job->quiet && (ret == SOINFO_ERROR_ELF ||
+                           ret == SOINFO_ERROR_NODYN)) {
+            return;
+        }
+        if (ret == SOINFO_ERROR_OPEN) {
+            snprintf(job->msg, sizeof(job->msg), "open '%s' failed: %s",
+                     job->path, strerror(errnum));
+        } else {
+            snprintf(job->msg, sizeof(job->msg), "error parsing '%s': %s",
+                     job->path, soinfo_strerror(ret));
+        }
+        job->failed = true;
+        return;
     }
 
-    Elf *e = elf_begin(fd, ELF_C_READ, NULL);
-    if (e == NULL) {
-        errx(EXIT_FAILURE, "elf_begin() failed: %s",
-            elf_errmsg(-1));
+    if (outbuf_init(&job->out, -1, 4096) == -1) {
+        snprintf(job->msg, sizeof(job->msg), "'%s': %s",
+                 job->path, strerror(errno));
+        job->failed = true;
+    } else {
+        printInfo(&job->out, opts, job->path, info);
     }
+}
 
-    if (elf_kind(e) != ELF_K_ELF) {
-        errx(EXIT_FAILURE, "'%s' is not an ELF object",
-            argv[1]);
+
+/* Parse the file of 'job' and format the result. */
+void runJob(const struct options *opts, struct soinfo_arena *arena,
+            struct job *job)
+{
+    struct soinfo *info = NULL;
+    int ret;
+    if (opts->cache != NULL) {
+        ret = soinfo_cache_load(opts->cache, &info, job->path, opts->flags,
+                                arena);
+    } else {
+        ret = soinfo_load_arena(&info, job->path, opts->flags, arena);
     }
+    finishJob(opts, job, ret, errno, info);
+}
+
+
+/* Write out every finished job at the head of the window, in order.
+ * Called with the lock held, which is dropped while writing so that a
+ * slow stdout or stderr doesn't hold up the workers: jobs that are
+ * done are no longer touched by them, and their slots aren't reused
+ * until 'written' moves past them. */
+void writeFinished(struct pool *pool)
+{
+    for (;;) {
+        size_t start = pool->written;
+        size_t end = start;
+        while (end < pool->produced && pool->ring[end % pool->window].done) {
+            end++;
+        }
+        /* Checked with the lock held, so that a job finishing after
+         * this is seen by the caller waiting on the condition. */
+        if (end == start) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        bool failed = false;
+        for (size_t n = start; n < end; n++) {
+            struct job *job = &pool->ring[n % pool->window];
+            if (job->failed) {
+                warnx("%s", job->msg);
+                failed = true;
+            } else if (job->out.buf != NULL) {
+                outbuf_write(pool->out, job->out.buf, job->out.len);
+                outbuf_free(&job->out);
+            }
+            free(job->path);
+        }
 
-    Elf_Scn *scn = NULL;
-    while ((scn = elf_nextscn(e, scn)) != NULL) {
-        GElf_Shdr shdr;
-        if (gelf_getshdr(scn, &shdr) == NULL) {
-            errx(EXIT_FAILURE, "getshdr() failed: %s.",
-                elf_errmsg(-1));
+        pthread_mutex_lock(&pool->lock);
+        pool->written = end;
+        if (failed) {
+            pool->failed = true;
         }
+        /* Slots freed up for the producer. */
+        pthread_cond_broadcast(&pool->cond);
+    }
+}
 
-        if (shdr.sh_type == SHT_DYNAMIC) {
+
+void *worker(void *arg)
+{
+    struct pool *pool = arg;
+    struct soinfo_arena arena;
+    soinfo_arena_init(&arena);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->taken == pool->produced && !pool->finished) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->taken == pool->produced) {
             break;
         }
+
+        struct job *job = &pool->ring[pool->taken++ % pool->window];
+        pthread_mutex_unlock(&pool->lock);
+
+        runJob(pool->opts, &arena, job);
+        soinfo_arena_reset(&arena);
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    if (arena.peak > pool->peak) {
+        pool->peak = arena.peak;
     }
+    pthread_mutex_unlock(&pool->lock);
+
+    soinfo_arena_free(&arena);
+    return NULL;
+}
 
-    if (scn == NULL) {
-        errx(EXIT_FAILURE, "SHT_DYNAMIC section not found",
-            elf_errmsg(-1));
+
+/* With -u: claim jobs into a batch as long as it has room, only
+ * waiting for more when it is empty, and finish them as their loads
+ * complete. */
+void *batchWorker(void *arg)
+{
+    struct pool *pool = arg;
+    const struct options *opts = pool->opts;
+
+    struct soinfo_batch *batch;
+    int ret = soinfo_batch_open(&batch, opts->depth, opts->flags);
+    if (ret != SOINFO_SUCCESS) {
+        errx(EXIT_FAILURE, "soinfo_batch_open() failed: %s",
+             soinfo_strerror(ret));
     }
 
-    Elf_Data *data = elf_getdata(scn, NULL);
-    if (data == NULL) {
-        errx(EXIT_FAILURE, "elf_getdata() failed: %s",
-            elf_errmsg(-1));
+    unsigned pending = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->taken == pool->produced && !pool->finished &&
+               pending == 0) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        /* Jobs are added one at a time with the lock dropped, since
+         * without io_uring adding a file loads it there and then. */
+        if (pending < opts->depth && pool->taken < pool->produced) {
+            struct job *job = &pool->ring[pool->taken++ % pool->window];
+            pthread_mutex_unlock(&pool->lock);
+
+            ret = soinfo_batch_add(batch, job->path, job);
+            if (ret == SOINFO_SUCCESS) {
+                pending++;
+                pthread_mutex_lock(&pool->lock);
+                continue;
+            }
+            finishJob(opts, job, ret, errno, NULL);
+
+            pthread_mutex_lock(&pool->lock);
+            job->done = true;
+            pthread_cond_broadcast(&pool->cond);
+            continue;
+        }
+        if (pending == 0) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        struct soinfo_result res;
+        ret = soinfo_batch_next(batch, &res);
+        if (ret != SOINFO_SUCCESS) {
+            err(EXIT_FAILURE, "soinfo_batch_next() failed");
+        }
+        struct job *job = res.data;
+        finishJob(opts, job, res.error, res.errnum, res.info);
+        pending--;
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool->cond);
     }
+    pthread_mutex_unlock(&pool->lock);
+
+    soinfo_batch_close(batch);
+    return NULL;
+}
 
-    size_t num_entries = data->d_size/sizeof(GElf_Dyn);
 
-    uintptr_t strtabptr;
-    uintptr_t sonameptr;
-    uintptr_t depptr[num_entries];
-    size_t numdeps = 0;
+/* Queue 'path', waiting for room in the window. While waiting, the
+ * producer writes out whatever has finished. */
+void submit(struct pool *pool, const char *path, bool quiet)
+{
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        err(EXIT_FAILURE, "strdup() failed");
+    }
 
-    for (int i = 0; i < num_entries; i++) {
-        GElf_Dyn dyn;
-        if (gelf_getdyn(data, i, &dyn) == NULL) {
-            errx(EXIT_FAILURE, "gelf_getdyn() failed: %s",
-                elf_errmsg(-1));
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        writeFinished(pool);
+        if (pool->produced - pool->written < pool->window) {
+            break;
         }
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
 
-        switch (dyn.d_tag) {
-            case DT_STRTAB:
-                strtabptr = dyn.d_un.d_ptr;
+    struct job *job = &pool->ring[pool->produced % pool->window];
+    memset(job, 0, sizeof(*job));
+    job->path = copy;
+    job->quiet = quiet;
+    pool->produced++;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+int compareNames(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+
+/* Queue every regular file below 'dir', in sorted order. Symbolic
+ * links are not followed, so a library is not parsed again under each
+ * of its sonames, and directory loops can't occur. */
+void walkDir(struct pool *pool, const char *dir)
+{
+    struct dirent **names;
+    int n = scandir(dir, &names, NULL, compareNames);
+    if (n < 0) {
+        warn("scandir '%s' failed", dir);
+        pthread_mutex_lock(&pool->lock);
+        pool->failed = true;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const char *name = names[i]->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            free(names[i]);
+            continue;
+        }
+
+        char *path;
+        if (asprintf(&path, "%s/%s", dir, name) < 0) {
+            err(EXIT_FAILURE, "asprintf() failed");
+        }
+
+        unsigned char type = names[i]->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path, &st) == 0) {
+                type = S_ISDIR(st.st_mode) ? DT_DIR :
+                       S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+        }
+
+        if (type == DT_DIR) {
+            walkDir(pool, path);
+        } else if (type == DT_REG) {
+            submit(pool, path, true);
+        }
+
+        free(path);
+        free(names[i]);
+    }
+    free(names);
+}
+
+
+/* Queue a path named on the command line or in a list file. */
+void addPath(struct pool *pool, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        walkDir(pool, path);
+        return;
+    }
+    submit(pool, path, false);
+}
+
+
+/* Queue each path listed one per line in 'list' ('-' for stdin). */
+void addList(struct pool *pool, const char *list)
+{
+    FILE *fp = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+    if (fp == NULL) {
+        err(EXIT_FAILURE, "open '%s' failed", list);
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, fp)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            addPath(pool, line);
+        }
+    }
+
+    free(line);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+}
+
+
+void usage(const char *prog)
+{
+    errx(EXIT_FAILURE, "usage: %s [-ps] [-c cache] [-j jobs] [-o text|json] "
+        "[-u depth] file|directory|@list...", prog);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct options opts = { 0 };
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char *cache = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:j:o:psu:")) != -1) {
+        switch (opt) {
+            case 'c':
+                cache = optarg;
+                break;
+            case 'j':
+                jobs = strtol(optarg, NULL, 10);
+                if (jobs < 1 || jobs > 1024) {
+                    errx(EXIT_FAILURE, "invalid number of jobs '%s'", optarg);
+                }
                 break;
-            case DT_SONAME:
-                sonameptr = dyn.d_un.d_ptr;
+            case 'o':
+                if (strcmp(optarg, "json") == 0) {
+                    opts.json = true;
+                } else if (strcmp(optarg, "text") != 0) {
+                    errx(EXIT_FAILURE, "unknown output format '%s'",
+                        optarg);
+                }
                 break;
-            case DT_NEEDED:
-                depptr[numdeps++] = dyn.d_un.d_ptr;
+            case 'p':
+                opts.flags |= SOINFO_PREAD;
                 break;
+            case 's':
+                opts.stats = true;
+                break;
+            case 'u': {
+                long depth = strtol(optarg, NULL, 10);
+                if (depth < 1 || depth > SOINFO_BATCH_MAX) {
+                    errx(EXIT_FAILURE, "invalid batch depth '%s'", optarg);
+                }
+                opts.depth = depth;
+                break;
+            }
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    /* A batch loads into arenas of its own, and bypasses the cache. */
+    if (opts.depth > 0 && (cache != NULL || opts.stats)) {
+        errx(EXIT_FAILURE, "-u can't be combined with -c or -s");
+    }
+
+    /* A single file prints just like it always has. Anything that can
+     * produce several results labels each one. */
+    struct stat st;
+    opts.batch = argc - optind > 1 || argv[optind][0] == '@' ||
+                 (stat(argv[optind], &st) == 0 && S_ISDIR(st.st_mode));
+
+    if (cache != NULL) {
+        int ret = soinfo_cache_open(&opts.cache, cache, 0);
+        if (ret == SOINFO_ERROR_OPEN) {
+            err(EXIT_FAILURE, "open '%s' failed", cache);
+        }
+        if (ret != SOINFO_SUCCESS) {
+            errx(EXIT_FAILURE, "error opening '%s': %s",
+                cache, soinfo_strerror(ret));
         }
     }
 
-    Elf_Scn *strtabscn = gelf_offscn(e, strtabptr);
-    if (strtabscn == NULL) {
-        errx(EXIT_FAILURE, "gelf_offscn() failed: %s",
-            elf_errmsg(-1));
+    struct outbuf out;
+    if (outbuf_init(&out, STDOUT_FILENO, 0) == -1) {
+        err(EXIT_FAILURE, "malloc() failed");
+    }
+
+    struct pool pool = {
+        .opts = &opts,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .window = 4 * jobs,
+        .out = &out,
+    };
+    /* With -u, room to keep every worker's batch full twice over, but
+     * no more than one largest batch beyond the usual window, since
+     * the slots are allocated up front and -j 1024 -u 4096 would
+     * otherwise take gigabytes. */
+    if (opts.depth > 0) {
+        size_t want = 2 * (size_t)jobs * opts.depth;
+        size_t max = 2 * (size_t)jobs + SOINFO_BATCH_MAX;
+        pool.window = want < max ? want : max;
+    }
+    pool.ring = calloc(pool.window, sizeof(*pool.ring));
+    if (pool.ring == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
     }
 
-    size_t strtabndx = elf_ndxscn(strtabscn);
-    if (strtabndx == SHN_UNDEF) {
-        errx(EXIT_FAILURE, "elf_ndxscn() failed: %s",
-            elf_errmsg(-1));
+    pthread_t *threads = calloc(jobs, sizeof(*threads));
+    if (threads == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
+    }
+    for (long i = 0; i < jobs; i++) {
+        int ret = pthread_create(&threads[i], NULL,
+                                 opts.depth > 0 ? batchWorker : worker,
+                                 &pool);
+        if (ret != 0) {
+            errno = ret;
+            err(EXIT_FAILURE, "pthread_create() failed");
+        }
     }
 
-    char *soname = elf_strptr(e, strtabndx, sonameptr);
-    if (soname == NULL) {
-        errx(EXIT_FAILURE, "elf_strptr() failed: %s.",
-            elf_errmsg(-1));
+    for (int i = optind; i < argc; i++) {
+        if (argv[i][0] == '@') {
+            addList(&pool, argv[i] + 1);
+        } else {
+            addPath(&pool, argv[i]);
+        }
     }
 
-    char *dep[numdeps];
-    for (int i = 0; i < numdeps;  i++) {
-        dep[i] = elf_strptr(e, strtabndx, depptr[i]);
-        if (dep[i] == NULL) {
-            errx(EXIT_FAILURE, "elf_strptr() failed: %s.",
-                elf_errmsg(-1));
+    pthread_mutex_lock(&pool.lock);
+    pool.finished = true;
+    pthread_cond_broadcast(&pool.cond);
+    while (pool.written < pool.produced) {
+        writeFinished(&pool);
+        if (pool.written < pool.produced) {
+            pthread_cond_wait(&pool.cond, &pool.lock);
         }
     }
-        
-    printf("soname: %s\n", soname);
-    for (int i = 0; i < numdeps;  i++) {
-        printf("dep[%d]: %s\n", i, dep[i]);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (long i = 0; i < jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (outbuf_flush(&out) == -1) {
+        err(EXIT_FAILURE, "write() failed");
     }
+    outbuf_free(&out);
+    free(pool.ring);
+    free(threads);
+    soinfo_cache_close(opts.cache);
 
-    elf_end(e);
-    close(fd);
-    return 0;
+    if (opts.stats) {
+        fprintf(stderr, "arena peak: %zu bytes\n", pool.peak);
+    }
+    return pool.failed ? EXIT_FAILURE : 0;
 }
@@ -0,0 +1,143 @@
+#ifndef SOINFO_H
+#define SOINFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Error codes returned by the soinfo_*() functions. When
+ * SOINFO_ERROR_OPEN is returned, errno is left set to the value
+ * reported by the failing system call. */
+enum soinfo_error {
+    SOINFO_SUCCESS = 0,
+    SOINFO_ERROR_INVAL,  /* Invalid argument. */
+    SOINFO_ERROR_OPEN,   /* Opening the file failed. */
+    SOINFO_ERROR_ELF,    /* The file is not an ELF object. */
+    SOINFO_ERROR_NOMEM,  /* Memory allocation failed. */
+    SOINFO_ERROR_FORMAT, /* The object is malformed. */
+    SOINFO_ERROR_NODYN,  /* The object has no dynamic section. */
+    SOINFO_ERROR_CACHE,  /* The result cache file is not valid. */
+};
+
+/* The dynamic linking information of an ELF object. */
+struct soinfo {
+    int elfclass;        /* ELFCLASS32 or ELFCLASS64. */
+    int machine;         /* e_machine, e.g. EM_X86_64. */
+    uint32_t flags;      /* e_flags, which carry the ABI on some archs. */
+    const char *soname;  /* DT_SONAME, or NULL if there is none. */
+    size_t ndeps;
+    const char **deps;   /* DT_NEEDED entries, in order. */
+    uint64_t nread;      /* Bytes read from the file with SOINFO_PREAD. */
+};
+
+/* Flags for soinfo_load(). */
+#define SOINFO_PREAD 0x0001 /* Read only the parts of the file needed. */
+#define SOINFO_SYNC  0x0002 /* soinfo_batch_open(): don't use io_uring. */
+
+/* A bump allocator for soinfo_load_arena(). Everything a load needs,
+ * from the bytes read to the result, comes out of the arena, and is
+ * given back all at once by soinfo_arena_reset(). Once the arena has
+ * grown to fit the largest object, scanning more objects allocates
+ * nothing and a reset is O(1). */
+struct soinfo_arena {
+    struct soinfo_chunk *chunk;
+    size_t used;  /* Bytes handed out since the last reset. */
+    size_t peak;  /* The most ever handed out between resets. */
+};
+
+void soinfo_arena_init(struct soinfo_arena *arena);
+void soinfo_arena_reset(struct soinfo_arena *arena);
+void soinfo_arena_free(struct soinfo_arena *arena);
+
+/* Parse the ELF object at 'path'. On success '*info' must be released
+ * with soinfo_free().
+ *
+ * By default the object is mapped and its dynamic segment located
+ * through the program headers, which works for any class and byte
+ * order and needs no section headers. With SOINFO_PREAD, the header,
+ * program headers, dynamic segment and strings are instead fetched
+ * with pread(), so that only a few KB of even a very large object are
+ * read; the amount is returned in 'nread'.
+ *
+ * Defining SOINFO_LIBELF at build time parses the SHT_DYNAMIC section
+ * with libelf instead, which ignores SOINFO_PREAD. */
+int soinfo_load(struct soinfo **info, const char *path, int flags);
+void soinfo_free(struct soinfo *info);
+
+/* Like soinfo_load(), but '*info' lives in 'arena' until it is reset,
+ * and must not be passed to soinfo_free(). A failed load may still
+ * have used some of the arena. */
+int soinfo_load_arena(struct soinfo **info, const char *path, int flags,
+                      struct soinfo_arena *arena);
+
+/* Return a static string describing a soinfo_error code. */
+const char *soinfo_strerror(int error);
+
+/* A persistent cache of soinfo results, keyed by the device, inode,
+ * size, mtime and ctime of each file, so that scanning an unchanged
+ * object costs a stat() rather than a parse. The cache lives in an
+ * append-only file shared by all its users, and may be used from
+ * several threads.
+ *
+ * soinfo_cache_open() creates the file at 'path' if needed; if it
+ * can't be written, it is only read. The file is compacted when the
+ * cache is closed if it has grown beyond 'cap' bytes (0 for a default
+ * of 16 MB) or if most of it is taken by records for files that have
+ * since changed. Compaction drops the records of files that are gone
+ * or changed, then the oldest records while the file exceeds 'cap'. */
+struct soinfo_cache;
+
+int soinfo_cache_open(struct soinfo_cache **cache, const char *path,
+                      size_t cap);
+int soinfo_cache_compact(struct soinfo_cache *cache);
+void soinfo_cache_close(struct soinfo_cache *cache);
+
+/* Like soinfo_load_arena(), answering from 'cache' when it holds a
+ * result for the file and adding the result to it otherwise. The
+ * strings of '*info' may point into the cache, so it is only valid
+ * until the arena is reset or the cache is closed. */
+int soinfo_cache_load(struct soinfo_cache *cache, struct soinfo **info,
+                      const char *path, int flags,
+                      struct soinfo_arena *arena);
+
+/* A batch loader for scanning many files from one thread. Up to
+ * 'depth' loads are in flight at once, and their results come back in
+ * the order they complete.
+ *
+ * Where the kernel supports io_uring, the open, fstat and reads of
+ * every file in the batch are queued on one ring, and each file's next
+ * read (the program headers, the dynamic segment, the strings) is
+ * queued as the previous one completes, so that the reads of many
+ * files overlap for a few system calls in all. Only the ranges needed
+ * are read, as with SOINFO_PREAD. Otherwise, with SOINFO_SYNC, or when
+ * built with SOINFO_LIBELF or SOINFO_NOURING, each file is loaded as
+ * soinfo_load() would when it is added, with 'flags'.
+ *
+ * A batch may only be used by one thread at a time. */
+struct soinfo_batch;
+
+/* The largest depth of a batch. */
+#define SOINFO_BATCH_MAX 4096
+
+struct soinfo_result {
+    void *data;           /* As passed to soinfo_batch_add(). */
+    int error;            /* The soinfo_error code of the load. */
+    int errnum;           /* errno, with SOINFO_ERROR_OPEN. */
+    struct soinfo *info;  /* The result, or NULL on error. */
+};
+
+int soinfo_batch_open(struct soinfo_batch **batch, unsigned depth,
+                      int flags);
+void soinfo_batch_close(struct soinfo_batch *batch);
+
+/* Start loading 'path', which is copied. Fails with SOINFO_ERROR_INVAL
+ * if 'depth' loads are already pending. */
+int soinfo_batch_add(struct soinfo_batch *batch, const char *path,
+                     void *data);
+
+/* Wait for a pending load to finish and return its result in '*res'.
+ * res->info is valid until the next call. Returns SOINFO_ERROR_INVAL
+ * if nothing is pending, or SOINFO_ERROR_OPEN with errno set if
+ * waiting on the ring fails. */
+int soinfo_batch_next(struct soinfo_batch *batch, struct soinfo_result *res);
+
+#endif /* SOINFO_H */
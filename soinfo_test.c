@@ -0,0 +1,815 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "soinfo.h"
+
+/* soinfo_test runs libsoinfo against small hand-built ELF objects of
+ * each class and byte order, checking that every way of loading one
+ * gives the same soname and dependencies. It prints each failed check
+ * and exits non-zero if there were any. */
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            failures++; \
+        } \
+    } while (0)
+
+
+/* What writeElf() puts in an object. */
+struct elf_spec {
+    int elfclass;           /* ELFCLASS32 or ELFCLASS64. */
+    int data;               /* ELFDATA2LSB or ELFDATA2MSB. */
+    int machine;
+    uint32_t flags;
+    const char *soname;     /* Or NULL for no DT_SONAME. */
+    const char *const *deps;
+    size_t ndeps;
+    size_t pad;             /* Bytes between the headers and strings. */
+    size_t misalign;        /* Bytes to misalign the dynamic segment by. */
+    bool nodyn;             /* Leave out the dynamic segment. */
+    bool badneeded;         /* Point the last DT_NEEDED past DT_STRSZ. */
+};
+
+/* The load address of the objects' single PT_LOAD segment. */
+#define VBASE 0x10000
+
+static void put(unsigned char *p, uint64_t v, size_t size, bool big)
+{
+    for (size_t i = 0; i < size; i++) {
+        p[big ? size - 1 - i : i] = v >> (8 * i);
+    }
+}
+
+/* Write 'field' of the Elf32_'type' or Elf64_'type' structure at 'p' in
+ * the class and byte order of 'spec'. */
+#define PUT(spec, p, type, field, v) \
+    ((spec)->elfclass == ELFCLASS64 ? \
+     put((p) + offsetof(Elf64_##type, field), (v), \
+         sizeof(((Elf64_##type *)0)->field), (spec)->data == ELFDATA2MSB) : \
+     put((p) + offsetof(Elf32_##type, field), (v), \
+         sizeof(((Elf32_##type *)0)->field), (spec)->data == ELFDATA2MSB))
+
+#define SIZEOF(spec, type) \
+    ((spec)->elfclass == ELFCLASS64 ? sizeof(Elf64_##type) \
+                                    : sizeof(Elf32_##type))
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+/* Write an object as 'spec' describes and return its path, and the
+ * offset of its dynamic segment in '*dynoff' if that is not NULL.
+ *
+ * The object is laid out as a linker would: the ELF header, a PT_LOAD
+ * program header mapping the whole file at VBASE and a PT_DYNAMIC one,
+ * the string table, the dynamic segment, then the section headers and
+ * their names, so that libelf finds the same through SHT_DYNAMIC. */
+char *writeElf(const struct elf_spec *spec, size_t *dynoff)
+{
+    char *path = strdup("/tmp/soinfo_test.XXXXXX");
+    int fd = path != NULL ? mkstemp(path) : -1;
+    if (fd < 0) {
+        err(EXIT_FAILURE, "mkstemp() failed");
+    }
+
+    size_t phoff = SIZEOF(spec, Ehdr);
+    size_t stroff = phoff + 2 * SIZEOF(spec, Phdr) + spec->pad;
+    size_t strsz = 1;
+    if (spec->soname != NULL) {
+        strsz += strlen(spec->soname) + 1;
+    }
+    for (size_t i = 0; i < spec->ndeps; i++) {
+        strsz += strlen(spec->deps[i]) + 1;
+    }
+
+    size_t ndyn = (spec->soname != NULL) + spec->ndeps + 3;
+    size_t dynsz = ndyn * SIZEOF(spec, Dyn);
+    size_t dyn = ALIGN8(stroff + strsz) + spec->misalign;
+
+    static const char shstrtab[] = "\0.dynstr\0.dynamic\0.shstrtab";
+    size_t shstroff = dyn + dynsz;
+    size_t shoff = ALIGN8(shstroff + sizeof(shstrtab));
+    size_t len = shoff + 4 * SIZEOF(spec, Shdr);
+
+    unsigned char *buf = calloc(1, len);
+    if (buf == NULL) {
+        err(EXIT_FAILURE, "calloc() failed");
+    }
+
+    unsigned char *ehdr = buf;
+    memcpy(ehdr, ELFMAG, SELFMAG);
+    ehdr[EI_CLASS] = spec->elfclass;
+    ehdr[EI_DATA] = spec->data;
+    ehdr[EI_VERSION] = EV_CURRENT;
+    PUT(spec, ehdr, Ehdr, e_type, ET_DYN);
+    PUT(spec, ehdr, Ehdr, e_machine, spec->machine);
+    PUT(spec, ehdr, Ehdr, e_version, EV_CURRENT);
+    PUT(spec, ehdr, Ehdr, e_phoff, phoff);
+    PUT(spec, ehdr, Ehdr, e_shoff, shoff);
+    PUT(spec, ehdr, Ehdr, e_flags, spec->flags);
+    PUT(spec, ehdr, Ehdr, e_ehsize, SIZEOF(spec, Ehdr));
+    PUT(spec, ehdr, Ehdr, e_phentsize, SIZEOF(spec, Phdr));
+    PUT(spec, ehdr, Ehdr, e_phnum, 2);
+    PUT(spec, ehdr, Ehdr, e_shentsize, SIZEOF(spec, Shdr));
+    PUT(spec, ehdr, Ehdr, e_shnum, 4);
+    PUT(spec, ehdr, Ehdr, e_shstrndx, 3);
+
+    unsigned char *ph = buf + phoff;
+    PUT(spec, ph, Phdr, p_type, PT_LOAD);
+    PUT(spec, ph, Phdr, p_flags, PF_R);
+    PUT(spec, ph, Phdr, p_vaddr, VBASE);
+    PUT(spec, ph, Phdr, p_paddr, VBASE);
+    PUT(spec, ph, Phdr, p_filesz, len);
+    PUT(spec, ph, Phdr, p_memsz, len);
+    PUT(spec, ph, Phdr, p_align, 0x1000);
+
+    ph += SIZEOF(spec, Phdr);
+    PUT(spec, ph, Phdr, p_type, spec->nodyn ? PT_NOTE : PT_DYNAMIC);
+    PUT(spec, ph, Phdr, p_flags, PF_R | PF_W);
+    PUT(spec, ph, Phdr, p_offset, dyn);
+    PUT(spec, ph, Phdr, p_vaddr, VBASE + dyn);
+    PUT(spec, ph, Phdr, p_paddr, VBASE + dyn);
+    PUT(spec, ph, Phdr, p_filesz, dynsz);
+    PUT(spec, ph, Phdr, p_memsz, dynsz);
+    PUT(spec, ph, Phdr, p_align, 8);
+
+    unsigned char *d = buf + dyn;
+    size_t str = 1;
+    if (spec->soname != NULL) {
+        strcpy((char *)buf + stroff + str, spec->soname);
+        PUT(spec, d, Dyn, d_tag, DT_SONAME);
+        PUT(spec, d, Dyn, d_un.d_val, str);
+        d += SIZEOF(spec, Dyn);
+        str += strlen(spec->soname) + 1;
+    }
+    for (size_t i = 0; i < spec->ndeps; i++) {
+        strcpy((char *)buf + stroff + str, spec->deps[i]);
+        bool bad = spec->badneeded && i == spec->ndeps - 1;
+        PUT(spec, d, Dyn, d_tag, DT_NEEDED);
+        PUT(spec, d, Dyn, d_un.d_val, bad ? strsz : str);
+        d += SIZEOF(spec, Dyn);
+        str += strlen(spec->deps[i]) + 1;
+    }
+    PUT(spec, d, Dyn, d_tag, DT_STRTAB);
+    PUT(spec, d, Dyn, d_un.d_val, VBASE + stroff);
+    d += SIZEOF(spec, Dyn);
+    PUT(spec, d, Dyn, d_tag, DT_STRSZ);
+    PUT(spec, d, Dyn, d_un.d_val, strsz);
+    d += SIZEOF(spec, Dyn);
+    PUT(spec, d, Dyn, d_tag, DT_NULL);
+
+    memcpy(buf + shstroff, shstrtab, sizeof(shstrtab));
+
+    unsigned char *sh = buf + shoff + SIZEOF(spec, Shdr);
+    PUT(spec, sh, Shdr, sh_name, 1);
+    PUT(spec, sh, Shdr, sh_type, SHT_STRTAB);
+    PUT(spec, sh, Shdr, sh_flags, SHF_ALLOC);
+    PUT(spec, sh, Shdr, sh_addr, VBASE + stroff);
+    PUT(spec, sh, Shdr, sh_offset, stroff);
+    PUT(spec, sh, Shdr, sh_size, strsz);
+    PUT(spec, sh, Shdr, sh_addralign, 1);
+
+    sh += SIZEOF(spec, Shdr);
+    PUT(spec, sh, Shdr, sh_name, 9);
+    PUT(spec, sh, Shdr, sh_type, spec->nodyn ? SHT_PROGBITS : SHT_DYNAMIC);
+    PUT(spec, sh, Shdr, sh_flags, SHF_ALLOC | SHF_WRITE);
+    PUT(spec, sh, Shdr, sh_addr, VBASE + dyn);
+    PUT(spec, sh, Shdr, sh_offset, dyn);
+    PUT(spec, sh, Shdr, sh_size, dynsz);
+    PUT(spec, sh, Shdr, sh_link, 1);
+    PUT(spec, sh, Shdr, sh_addralign, 8);
+    PUT(spec, sh, Shdr, sh_entsize, SIZEOF(spec, Dyn));
+
+    sh += SIZEOF(spec, Shdr);
+    PUT(spec, sh, Shdr, sh_name, 18);
+    PUT(spec, sh, Shdr, sh_type, SHT_STRTAB);
+    PUT(spec, sh, Shdr, sh_offset, shstroff);
+    PUT(spec, sh, Shdr, sh_size, sizeof(shstrtab));
+    PUT(spec, sh, Shdr, sh_addralign, 1);
+
+    if (write(fd, buf, len) != (ssize_t)len || close(fd) == -1) {
+        err(EXIT_FAILURE, "write '%s' failed", path);
+    }
+    free(buf);
+
+    if (dynoff != NULL) {
+        *dynoff = dyn;
+    }
+    return path;
+}
+
+
+/* Check that 'info' holds what 'spec' describes. */
+void checkInfo(const char *what, const struct soinfo *info,
+               const struct elf_spec *spec)
+{
+    CHECK(info->elfclass == spec->elfclass, "%s: class %d, expected %d",
+          what, info->elfclass, spec->elfclass);
+    CHECK(info->machine == spec->machine, "%s: machine %d, expected %d",
+          what, info->machine, spec->machine);
+    CHECK(info->flags == spec->flags, "%s: flags %#x, expected %#x",
+          what, info->flags, spec->flags);
+
+    if (spec->soname == NULL) {
+        CHECK(info->soname == NULL, "%s: soname '%s', expected none",
+              what, info->soname);
+    } else {
+        CHECK(info->soname != NULL && strcmp(info->soname, spec->soname) == 0,
+              "%s: soname '%s', expected '%s'", what,
+              info->soname != NULL ? info->soname : "(none)", spec->soname);
+    }
+
+    CHECK(info->ndeps == spec->ndeps, "%s: %zu deps, expected %zu", what,
+          info->ndeps, spec->ndeps);
+    for (size_t i = 0; i < info->ndeps && i < spec->ndeps; i++) {
+        CHECK(strcmp(info->deps[i], spec->deps[i]) == 0,
+              "%s: dep %zu is '%s', expected '%s'", what, i, info->deps[i],
+              spec->deps[i]);
+    }
+}
+
+
+/* Load the object at 'path' with 'flags', both on its own and into an
+ * arena, and check the results against 'spec'. */
+void checkLoad(const char *what, const char *path, int flags,
+               const struct elf_spec *spec)
+{
+    struct soinfo *info;
+    int ret = soinfo_load(&info, path, flags);
+    CHECK(ret == SOINFO_SUCCESS, "%s: load failed: %s", what,
+          soinfo_strerror(ret));
+    if (ret == SOINFO_SUCCESS) {
+        checkInfo(what, info, spec);
+        soinfo_free(info);
+    }
+
+    struct soinfo_arena arena;
+    soinfo_arena_init(&arena);
+    ret = soinfo_load_arena(&info, path, flags, &arena);
+    CHECK(ret == SOINFO_SUCCESS, "%s: arena load failed: %s", what,
+          soinfo_strerror(ret));
+    if (ret == SOINFO_SUCCESS) {
+        checkInfo(what, info, spec);
+    }
+    soinfo_arena_free(&arena);
+}
+
+
+static const char *const deps[] = {
+    "libc.so.6", "libm.so.6", "ld-linux-x86-64.so.2", "libpthread.so.0",
+};
+
+/* One object of each class and byte order, with an e_machine and
+ * e_flags that go with it. */
+static const struct elf_spec classes[] = {
+#define CLASS(c, d, m, f) \
+    { .elfclass = (c), .data = (d), .machine = (m), .flags = (f), \
+      .soname = "libfoo.so.1", .deps = deps, .ndeps = 4 }
+    CLASS(ELFCLASS64, ELFDATA2LSB, EM_X86_64, 0),
+    CLASS(ELFCLASS32, ELFDATA2LSB, EM_386, 0),
+    CLASS(ELFCLASS64, ELFDATA2MSB, EM_PPC64, 1),
+    CLASS(ELFCLASS32, ELFDATA2MSB, EM_MIPS, 0x70001007),
+#undef CLASS
+};
+
+static const char *className(const struct elf_spec *spec)
+{
+    if (spec->elfclass == ELFCLASS64) {
+        return spec->data == ELFDATA2LSB ? "ELF64 LSB" : "ELF64 MSB";
+    }
+    return spec->data == ELFDATA2LSB ? "ELF32 LSB" : "ELF32 MSB";
+}
+
+
+/* Every class and byte order gives the soname and dependencies it was
+ * written with, as does an object with neither. */
+void testClasses(void)
+{
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        char *path = writeElf(&classes[i], NULL);
+        checkLoad(className(&classes[i]), path, 0, &classes[i]);
+        unlink(path);
+        free(path);
+    }
+
+    struct elf_spec bare = classes[0];
+    bare.soname = NULL;
+    bare.ndeps = 0;
+    char *path = writeElf(&bare, NULL);
+    checkLoad("no soname or deps", path, 0, &bare);
+    unlink(path);
+    free(path);
+}
+
+
+/* With SOINFO_PREAD every class and byte order gives the same results
+ * as a mapping, reading only the ranges the parser looks at, even when
+ * the strings outgrow the first window read or follow a large gap. */
+void testPread(void)
+{
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        char what[64];
+        snprintf(what, sizeof(what), "%s pread", className(&classes[i]));
+        char *path = writeElf(&classes[i], NULL);
+        checkLoad(what, path, SOINFO_PREAD, &classes[i]);
+        unlink(path);
+        free(path);
+    }
+
+    /* Enough long names to take several string table windows. */
+    static char names[64][40];
+    static const char *many[64];
+    for (size_t i = 0; i < 64; i++) {
+        snprintf(names[i], sizeof(names[i]),
+                 "libsomething-rather-long-%02zu.so.1", i);
+        many[i] = names[i];
+    }
+    struct elf_spec spec = classes[3];
+    spec.deps = many;
+    spec.ndeps = 64;
+    char *path = writeElf(&spec, NULL);
+    checkLoad("many deps", path, 0, &spec);
+    checkLoad("many deps pread", path, SOINFO_PREAD, &spec);
+    unlink(path);
+    free(path);
+
+    /* The bytes read are counted, and are nowhere near the size of an
+     * object with a megabyte between its headers and its strings. */
+    spec = classes[0];
+    spec.pad = 1024 * 1024;
+    path = writeElf(&spec, NULL);
+    checkLoad("padded pread", path, SOINFO_PREAD, &spec);
+
+    struct soinfo *info;
+    int ret = soinfo_load(&info, path, 0);
+    CHECK(ret == SOINFO_SUCCESS && info->nread == 0,
+          "padded mmap: %s, read %" PRIu64 " bytes", soinfo_strerror(ret),
+          ret == SOINFO_SUCCESS ? info->nread : 0);
+    if (ret == SOINFO_SUCCESS) {
+        soinfo_free(info);
+    }
+
+#ifndef SOINFO_LIBELF
+    ret = soinfo_load(&info, path, SOINFO_PREAD);
+    CHECK(ret == SOINFO_SUCCESS && info->nread > 0 && info->nread <= 4096,
+          "padded pread: %s, read %" PRIu64 " bytes", soinfo_strerror(ret),
+          ret == SOINFO_SUCCESS ? info->nread : 0);
+    if (ret == SOINFO_SUCCESS) {
+        soinfo_free(info);
+    }
+#endif
+    unlink(path);
+    free(path);
+}
+
+
+/* A 64-bit object in our byte order has its dynamic segment read in
+ * place when it is aligned, and copied out entry by entry when it is
+ * not; both must give the same results as the other classes. */
+void testNativeDyn(void)
+{
+    struct elf_spec spec = classes[0];
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    spec = classes[2];
+#endif
+
+    for (size_t misalign = 0; misalign < 8; misalign++) {
+        char what[64];
+        snprintf(what, sizeof(what), "dynamic segment misaligned by %zu",
+                 misalign);
+        spec.misalign = misalign;
+        char *path = writeElf(&spec, NULL);
+        checkLoad(what, path, 0, &spec);
+        checkLoad(what, path, SOINFO_PREAD, &spec);
+        unlink(path);
+        free(path);
+    }
+}
+
+
+/* Check that loading 'path' fails with 'error'. */
+void checkError(const char *what, const char *path, int error)
+{
+    struct soinfo *info;
+    int ret = soinfo_load(&info, path, 0);
+    CHECK(ret == error, "%s: got '%s', expected '%s'", what,
+          soinfo_strerror(ret), soinfo_strerror(error));
+    if (ret == SOINFO_SUCCESS) {
+        soinfo_free(info);
+    }
+}
+
+
+void testErrors(void)
+{
+    checkError("missing file", "/nonexistent/libfoo.so", SOINFO_ERROR_OPEN);
+    CHECK(errno == ENOENT, "missing file: errno %d, expected ENOENT", errno);
+    checkError("directory", "/tmp", SOINFO_ERROR_ELF);
+
+    char *path = strdup("/tmp/soinfo_test.XXXXXX");
+    int fd = path != NULL ? mkstemp(path) : -1;
+    if (fd < 0) {
+        err(EXIT_FAILURE, "mkstemp() failed");
+    }
+    checkError("empty file", path, SOINFO_ERROR_ELF);
+
+    static const char text[] = "#!/bin/sh\nexec /usr/bin/true \"$@\"\n";
+    if (write(fd, text, strlen(text)) != (ssize_t)strlen(text) ||
+        close(fd) == -1) {
+        err(EXIT_FAILURE, "write '%s' failed", path);
+    }
+    checkError("script", path, SOINFO_ERROR_ELF);
+    unlink(path);
+    free(path);
+
+    struct elf_spec spec = classes[3];
+    spec.nodyn = true;
+    path = writeElf(&spec, NULL);
+    checkError("no dynamic segment", path, SOINFO_ERROR_NODYN);
+    unlink(path);
+    free(path);
+
+    spec = classes[3];
+    spec.badneeded = true;
+    path = writeElf(&spec, NULL);
+    checkError("DT_NEEDED past DT_STRSZ", path, SOINFO_ERROR_FORMAT);
+    unlink(path);
+    free(path);
+
+    /* Cut off in the middle of the dynamic segment, which the program
+     * headers still claim. */
+    size_t dynoff;
+    path = writeElf(&classes[0], &dynoff);
+    if (truncate(path, dynoff + 8) == -1) {
+        err(EXIT_FAILURE, "truncate '%s' failed", path);
+    }
+    checkError("truncated", path, SOINFO_ERROR_FORMAT);
+    unlink(path);
+    free(path);
+}
+
+
+/* Load 'path' through 'cache', check the result against 'spec' and
+ * return whether it was answered from the cache. A cached result only
+ * takes the soinfo itself from the arena, since its strings point into
+ * the cache, where a parse also copies the strings into it. */
+bool cacheLoad(const char *what, struct soinfo_cache *cache,
+               const char *path, const struct elf_spec *spec)
+{
+    struct soinfo_arena arena;
+    soinfo_arena_init(&arena);
+
+    struct soinfo *info;
+    int ret = soinfo_cache_load(cache, &info, path, 0, &arena);
+    CHECK(ret == SOINFO_SUCCESS, "%s: load failed: %s", what,
+          soinfo_strerror(ret));
+    bool hit = false;
+    if (ret == SOINFO_SUCCESS) {
+        checkInfo(what, info, spec);
+        size_t own = sizeof(*info) + info->ndeps * sizeof(char *);
+        hit = arena.used <= ((own + 15) & ~(size_t)15);
+    }
+    soinfo_arena_free(&arena);
+    return hit;
+}
+
+
+/* Overwrite the object at 'path' in place, keeping its inode, with one
+ * as 'spec' describes. */
+void rewriteElf(const char *path, const struct elf_spec *spec)
+{
+    char *tmp = writeElf(spec, NULL);
+    FILE *in = fopen(tmp, "r");
+    FILE *out = fopen(path, "r+");
+    if (in == NULL || out == NULL) {
+        err(EXIT_FAILURE, "open '%s' failed", in == NULL ? tmp : path);
+    }
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            err(EXIT_FAILURE, "write '%s' failed", path);
+        }
+    }
+    if (fclose(out) == EOF) {
+        err(EXIT_FAILURE, "write '%s' failed", path);
+    }
+    fclose(in);
+    unlink(tmp);
+    free(tmp);
+}
+
+
+/* Set the mtime of 'path' to 'mtime', which also sets its ctime to the
+ * current time. File times come from a coarse clock, so this retries
+ * until the ctime differs from 'ctime'. */
+void setMtime(const char *path, struct timespec mtime, struct timespec ctime)
+{
+    struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, mtime };
+    struct stat st;
+    do {
+        if (utimensat(AT_FDCWD, path, times, 0) == -1 ||
+            stat(path, &st) == -1) {
+            err(EXIT_FAILURE, "utimensat '%s' failed", path);
+        }
+        if (st.st_ctim.tv_sec == ctime.tv_sec &&
+            st.st_ctim.tv_nsec == ctime.tv_nsec) {
+            usleep(1000);
+        }
+    } while (st.st_ctim.tv_sec == ctime.tv_sec &&
+             st.st_ctim.tv_nsec == ctime.tv_nsec);
+}
+
+
+/* An unchanged file is answered from the cache, in the same process or
+ * after reopening it, while a change to its mtime, or to its contents
+ * with the size and mtime put back as they were, has it parsed
+ * again. */
+void testCache(void)
+{
+    char *cachepath = strdup("/tmp/soinfo_test_cache.XXXXXX");
+    int fd = cachepath != NULL ? mkstemp(cachepath) : -1;
+    if (fd < 0) {
+        err(EXIT_FAILURE, "mkstemp() failed");
+    }
+    close(fd);
+
+    struct elf_spec spec = classes[3];
+    char *path = writeElf(&spec, NULL);
+
+    struct soinfo_cache *cache;
+    int ret = soinfo_cache_open(&cache, cachepath, 0);
+    CHECK(ret == SOINFO_SUCCESS, "cache open failed: %s",
+          soinfo_strerror(ret));
+    if (ret != SOINFO_SUCCESS) {
+        return;
+    }
+    CHECK(!cacheLoad("first load", cache, path, &spec),
+          "first load: answered from an empty cache");
+    CHECK(cacheLoad("second load", cache, path, &spec),
+          "second load: parsed again");
+    soinfo_cache_close(cache);
+
+    ret = soinfo_cache_open(&cache, cachepath, 0);
+    CHECK(ret == SOINFO_SUCCESS, "cache reopen failed: %s",
+          soinfo_strerror(ret));
+    if (ret != SOINFO_SUCCESS) {
+        return;
+    }
+    CHECK(cacheLoad("reopened", cache, path, &spec), "reopened: parsed again");
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        err(EXIT_FAILURE, "stat '%s' failed", path);
+    }
+    struct timespec later = st.st_mtim;
+    later.tv_sec += 10;
+    setMtime(path, later, st.st_ctim);
+    CHECK(!cacheLoad("new mtime", cache, path, &spec),
+          "new mtime: answered from the cache");
+    CHECK(cacheLoad("new mtime again", cache, path, &spec),
+          "new mtime again: parsed again");
+
+    /* Same length dependencies, so only the ctime tells. */
+    static const char *const other[] = {
+        "libx.so.6", "liby.so.6", "ld-linux-x86-64.so.3", "libpthread.so.1",
+    };
+    if (stat(path, &st) == -1) {
+        err(EXIT_FAILURE, "stat '%s' failed", path);
+    }
+    struct elf_spec changed = spec;
+    changed.deps = other;
+    rewriteElf(path, &changed);
+    setMtime(path, st.st_mtim, st.st_ctim);
+    CHECK(!cacheLoad("rewritten", cache, path, &changed),
+          "rewritten: answered from the cache");
+    CHECK(cacheLoad("rewritten again", cache, path, &changed),
+          "rewritten again: parsed again");
+
+    soinfo_cache_close(cache);
+    unlink(path);
+    free(path);
+    unlink(cachepath);
+    free(cachepath);
+}
+
+
+/* Compaction drops the records of files that are gone, then the oldest
+ * ones until the file is within its cap, keeping the newest. */
+void testCacheCompact(void)
+{
+    char *cachepath = strdup("/tmp/soinfo_test_cache.XXXXXX");
+    int fd = cachepath != NULL ? mkstemp(cachepath) : -1;
+    if (fd < 0) {
+        err(EXIT_FAILURE, "mkstemp() failed");
+    }
+    close(fd);
+
+    enum { NFILES = 40, CAP = 4096 };
+    char *paths[NFILES];
+    for (size_t i = 0; i < NFILES; i++) {
+        paths[i] = writeElf(&classes[i % 4], NULL);
+    }
+
+    struct soinfo_cache *cache;
+    int ret = soinfo_cache_open(&cache, cachepath, CAP);
+    CHECK(ret == SOINFO_SUCCESS, "cache open failed: %s",
+          soinfo_strerror(ret));
+    if (ret != SOINFO_SUCCESS) {
+        return;
+    }
+    for (size_t i = 0; i < NFILES; i++) {
+        cacheLoad("filling", cache, paths[i], &classes[i % 4]);
+    }
+
+    struct stat st;
+    if (stat(cachepath, &st) == -1) {
+        err(EXIT_FAILURE, "stat '%s' failed", cachepath);
+    }
+    CHECK(st.st_size > CAP, "filled cache is only %jd bytes",
+          (intmax_t)st.st_size);
+    off_t full = st.st_size;
+
+    /* Gone files go first. */
+    unlink(paths[NFILES - 1]);
+    ret = soinfo_cache_compact(cache);
+    CHECK(ret == SOINFO_SUCCESS, "compaction failed: %s",
+          soinfo_strerror(ret));
+    if (stat(cachepath, &st) == -1) {
+        err(EXIT_FAILURE, "stat '%s' failed", cachepath);
+    }
+    CHECK(st.st_size > 0 && st.st_size <= CAP,
+          "compacted from %jd to %jd bytes, over the cap of %d",
+          (intmax_t)full, (intmax_t)st.st_size, CAP);
+
+    /* Closing a cache over its cap compacts it too. */
+    for (size_t i = 0; i < NFILES - 1; i++) {
+        cacheLoad("refilling", cache, paths[i], &classes[i % 4]);
+    }
+    soinfo_cache_close(cache);
+    if (stat(cachepath, &st) == -1) {
+        err(EXIT_FAILURE, "stat '%s' failed", cachepath);
+    }
+    CHECK(st.st_size > 0 && st.st_size <= CAP,
+          "closed at %jd bytes, over the cap of %d", (intmax_t)st.st_size,
+          CAP);
+
+    /* What is left is the newest records, still valid. */
+    ret = soinfo_cache_open(&cache, cachepath, CAP);
+    CHECK(ret == SOINFO_SUCCESS, "cache reopen failed: %s",
+          soinfo_strerror(ret));
+    if (ret != SOINFO_SUCCESS) {
+        return;
+    }
+    CHECK(cacheLoad("newest", cache, paths[NFILES - 2],
+                    &classes[(NFILES - 2) % 4]),
+          "newest record was dropped");
+    CHECK(!cacheLoad("oldest", cache, paths[0], &classes[0]),
+          "oldest record was kept");
+    soinfo_cache_close(cache);
+
+    for (size_t i = 0; i < NFILES; i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    unlink(cachepath);
+    free(cachepath);
+}
+
+
+/* Run every class and byte order, a missing file and an object
+ * without a dynamic segment through a batch opened with 'flags', more
+ * of them than fit at once, and check each result against what was
+ * written. */
+void checkBatch(const char *mode, int flags)
+{
+    enum { DEPTH = 3, NFILES = 10 };
+    struct batch_file {
+        char *path;
+        struct elf_spec spec;
+        int error;
+        bool seen;
+    } files[NFILES];
+
+    for (size_t i = 0; i < NFILES; i++) {
+        files[i].spec = classes[i % 4];
+        files[i].error = SOINFO_SUCCESS;
+        files[i].seen = false;
+        if (i == 4) {
+            files[i].spec.nodyn = true;
+            files[i].error = SOINFO_ERROR_NODYN;
+        }
+        files[i].path = writeElf(&files[i].spec, NULL);
+    }
+    unlink(files[7].path);
+    files[7].error = SOINFO_ERROR_OPEN;
+
+    struct soinfo_batch *batch;
+    int ret = soinfo_batch_open(&batch, DEPTH, flags);
+    CHECK(ret == SOINFO_SUCCESS, "%s: open failed: %s", mode,
+          soinfo_strerror(ret));
+    if (ret != SOINFO_SUCCESS) {
+        return;
+    }
+
+    struct soinfo_result res;
+    ret = soinfo_batch_next(batch, &res);
+    CHECK(ret == SOINFO_ERROR_INVAL, "%s: next on an empty batch: %s",
+          mode, soinfo_strerror(ret));
+
+    size_t added = 0, pending = 0;
+    while (added < NFILES || pending > 0) {
+        if (added < NFILES && pending < DEPTH) {
+            ret = soinfo_batch_add(batch, files[added].path, &files[added]);
+            CHECK(ret == SOINFO_SUCCESS, "%s: add %zu failed: %s", mode,
+                  added, soinfo_strerror(ret));
+            added++;
+            pending++;
+            if (pending == DEPTH && added < NFILES) {
+                ret = soinfo_batch_add(batch, files[added].path, NULL);
+                CHECK(ret == SOINFO_ERROR_INVAL,
+                      "%s: add to a full batch: %s", mode,
+                      soinfo_strerror(ret));
+            }
+            continue;
+        }
+
+        ret = soinfo_batch_next(batch, &res);
+        CHECK(ret == SOINFO_SUCCESS, "%s: next failed: %s", mode,
+              soinfo_strerror(ret));
+        if (ret != SOINFO_SUCCESS) {
+            break;
+        }
+        pending--;
+
+        struct batch_file *f = res.data;
+        char what[64];
+        snprintf(what, sizeof(what), "%s file %zu", mode,
+                 (size_t)(f - files));
+        CHECK(!f->seen, "%s: returned twice", what);
+        f->seen = true;
+        CHECK(res.error == f->error, "%s: got '%s', expected '%s'", what,
+              soinfo_strerror(res.error), soinfo_strerror(f->error));
+        if (res.error == SOINFO_SUCCESS && f->error == SOINFO_SUCCESS) {
+            checkInfo(what, res.info, &f->spec);
+        }
+        if (f->error == SOINFO_ERROR_OPEN) {
+            CHECK(res.errnum == ENOENT, "%s: errno %d, expected ENOENT",
+                  what, res.errnum);
+        }
+    }
+    soinfo_batch_close(batch);
+
+    for (size_t i = 0; i < NFILES; i++) {
+        CHECK(files[i].seen, "%s file %zu: never returned", mode, i);
+        unlink(files[i].path);
+        free(files[i].path);
+    }
+}
+
+
+/* A batch gives the same results through io_uring (where the kernel
+ * allows it) as through plain loads, mapped or read. */
+void testBatch(void)
+{
+    checkBatch("batch", 0);
+    checkBatch("sync batch", SOINFO_SYNC);
+    checkBatch("sync pread batch", SOINFO_SYNC | SOINFO_PREAD);
+}
+
+
+int main(void)
+{
+    testClasses();
+    testPread();
+    testNativeDyn();
+    testErrors();
+    testCache();
+    testCacheCompact();
+    testBatch();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return 0;
+}